@@ -0,0 +1,83 @@
+/*
+ *  chippy.h
+ *  Chippy
+ *
+ *  Stable C ABI for embedding the emulator in other runtimes (Python/ctypes,
+ *  Julia, Lua, ...). A pool holds N environments running the same ROM and
+ *  advances all of them with one chippy_step() call, spread over worker
+ *  threads. Observations, rewards and done flags are written straight into
+ *  caller-owned contiguous buffers; nothing is allocated per step.
+ *
+ *  Copyright © 2016 bonsu. All rights reserved.
+ */
+
+#ifndef chippy_h
+#define chippy_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+#define CHIPPY_API __declspec(dllexport)
+#else
+#define CHIPPY_API __attribute__((visibility("default")))
+#endif
+
+#define CHIPPY_ABI_VERSION 2
+
+typedef struct chippy_pool chippy_pool;
+
+typedef enum {
+    CHIPPY_OBS_PACKED_BITS = 0, /* 256 bytes per env: 32 rows of 8 bytes, MSB is the leftmost pixel */
+    CHIPPY_OBS_BYTES = 1        /* 2048 bytes per env: one 0/1 byte per pixel, row-major */
+} chippy_obs_format;
+
+typedef enum {
+    CHIPPY_REWARD_VALUE = 0,    /* reward += scale * value after the step */
+    CHIPPY_REWARD_DELTA = 1     /* reward += scale * (value after - value before), as signed 8-bit */
+} chippy_reward_mode;
+
+CHIPPY_API int chippy_abi_version(void);
+
+/* numThreads = 0 uses every core. Each env is seeded with seed + its index. Returns NULL on failure. */
+CHIPPY_API chippy_pool *chippy_pool_create(const uint8_t *rom, size_t romSize, uint32_t numEnvs,
+                                           uint32_t seed, uint32_t numThreads);
+CHIPPY_API void chippy_pool_destroy(chippy_pool *pool);
+CHIPPY_API uint32_t chippy_pool_size(const chippy_pool *pool);
+
+/* emulator instructions per frame (default 10). */
+CHIPPY_API void chippy_set_instructions_per_frame(chippy_pool *pool, uint32_t instructions);
+
+CHIPPY_API size_t chippy_observation_size(chippy_obs_format format);
+
+/* buffers must stay valid until replaced or the pool is destroyed; pass NULL to disable.
+   observations: numEnvs * chippy_observation_size(format) bytes. rewards: numEnvs floats.
+   done: numEnvs bytes, set to 1 once an env has halted on an invalid opcode or stack fault. */
+CHIPPY_API void chippy_set_observation_buffer(chippy_pool *pool, void *observations, chippy_obs_format format);
+CHIPPY_API void chippy_set_reward_buffer(chippy_pool *pool, float *rewards);
+CHIPPY_API void chippy_set_done_buffer(chippy_pool *pool, uint8_t *done);
+
+/* reward hooks; all hooks are summed. Return 0 on success, -1 on a bad argument. */
+CHIPPY_API int chippy_add_memory_reward(chippy_pool *pool, uint16_t address, float scale, chippy_reward_mode mode);
+CHIPPY_API int chippy_add_register_reward(chippy_pool *pool, uint8_t reg, float scale, chippy_reward_mode mode);
+CHIPPY_API void chippy_clear_rewards(chippy_pool *pool);
+
+/* runs the boot state `frames` frames further with keyMask held (e.g. past a title screen), using
+   the pool seed. Envs are cheap copy-on-write clones of it and pick it up on their next reset. (ABI 2) */
+CHIPPY_API void chippy_advance_boot(chippy_pool *pool, uint32_t frames, uint16_t keyMask);
+
+/* back to the boot state; env < 0 resets every env. Observations are refreshed. */
+CHIPPY_API void chippy_reset(chippy_pool *pool, int32_t env);
+
+/* actions[i] is the 16-key mask (bit k = key k down) held by env i for all `frames` frames. */
+CHIPPY_API void chippy_step(chippy_pool *pool, const uint16_t *actions, uint32_t frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* chippy_h */
@@ -0,0 +1,91 @@
+//
+//  AtlasView.cpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include "AtlasView.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "Emulator.hpp"
+#include "SessionWall.hpp"
+
+using namespace ci;
+
+namespace {
+
+const uint8_t borderLevel = 48;
+
+} // namespace
+
+AtlasView::AtlasView(const int sessions)
+    : sessions(sessions)
+{
+    // tiles are 2:1, so a square count of them makes a roughly 2:1 wall like one display.
+    columns = std::max(1, (int)std::ceil(std::sqrt((double)sessions)));
+    rows = std::max(1, (sessions + columns - 1) / columns);
+    width = columns * tileWidth;
+    height = rows * tileHeight;
+
+    // borders everywhere, cleared tiles on top.
+    pixels.assign((size_t)width * height, borderLevel);
+    for (int s = 0; s < sessions; ++s) {
+        uint8_t *tile = &pixels[(size_t)(s / columns * tileHeight + 1) * width + s % columns * tileWidth + 1];
+        for (int y = 0; y < displayHeight; ++y)
+            std::memset(tile + (size_t)y * width, 0, displayWidth);
+    }
+
+    auto format = gl::Texture2d::Format().internalFormat(GL_R8).minFilter(GL_NEAREST).magFilter(GL_NEAREST);
+    format.setSwizzleMask(GL_RED, GL_RED, GL_RED, GL_ONE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    texture = gl::Texture2d::create(pixels.data(), GL_RED, width, height, format);
+    texture->setTopDown(true);
+}
+
+void AtlasView::expandTile(const int session)
+{
+    const uint64_t *rowsBits = &packed[(size_t)session * displayHeight];
+    uint8_t *tile = &pixels[(size_t)(session / columns * tileHeight + 1) * width + session % columns * tileWidth + 1];
+    for (int y = 0; y < displayHeight; ++y) {
+        uint8_t *out = tile + (size_t)y * width;
+        uint64_t bits = rowsBits[y];
+        for (int x = 0; x < displayWidth; ++x)
+            out[x] = (uint8_t)(0 - ((bits >> (displayWidth - 1 - x)) & 1));
+    }
+}
+
+int AtlasView::update(SessionWall &wall)
+{
+    int n = wall.collect(packed, changed);
+    if (!n)
+        return 0;
+    for (int s = 0; s < sessions; ++s)
+        if (changed[s])
+            expandTile(s);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    // past about half the wall, one upload of everything beats many small ones.
+    if (n * 2 > sessions) {
+        texture->update(pixels.data(), GL_RED, GL_UNSIGNED_BYTE, 0, width, height);
+        return n;
+    }
+    // each tile straight out of the atlas copy: rows are width apart.
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+    for (int s = 0; s < sessions; ++s) {
+        if (!changed[s])
+            continue;
+        int x = s % columns * tileWidth + 1, y = s / columns * tileHeight + 1;
+        texture->update(&pixels[(size_t)y * width + x], GL_RED, GL_UNSIGNED_BYTE, 0, displayWidth, displayHeight, ivec2(x, y));
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    return n;
+}
+
+void AtlasView::draw(const Rectf &bounds) const
+{
+    gl::draw(texture, bounds);
+}
@@ -0,0 +1,50 @@
+//
+//  AtlasView.hpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef AtlasView_hpp
+#define AtlasView_hpp
+
+#include <cstdint>
+#include <vector>
+
+#include "cinder/gl/gl.h"
+
+class SessionWall;
+
+// Shows every session of a SessionWall as a tile of one texture.
+//
+// The atlas is a single-channel texture with a one pixel border around each
+// tile. update() uploads only the tiles whose display changed, straight out
+// of a CPU copy of the whole atlas (or all of it in one go when most did);
+// draw() is one textured quad however many sessions there are.
+class AtlasView
+{
+public:
+    explicit AtlasView(int sessions);
+
+    // call once per host frame on the render thread; returns the tiles uploaded.
+    int update(SessionWall&);
+    void draw(const ci::Rectf &bounds) const;
+
+    // the atlas' own size, for fitting it into a window.
+    ci::Rectf getBounds() const { return texture->getBounds(); }
+    int getColumns() const { return columns; }
+
+private:
+    enum { tileWidth = 64 + 2, tileHeight = 32 + 2 };
+
+    int sessions, columns, rows;
+    int width, height;
+    std::vector<uint8_t> pixels;        // width * height, what the texture holds
+    std::vector<uint64_t> packed;
+    std::vector<uint8_t> changed;
+    ci::gl::Texture2dRef texture;
+
+    void expandTile(int session);
+};
+
+#endif /* AtlasView_hpp */
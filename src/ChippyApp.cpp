@@ -1,14 +1,27 @@
 #include "cinder/app/App.h"
 #include "cinder/app/RendererGl.h"
 #include "cinder/gl/gl.h"
+#include "cinder/Utilities.h"
 
 #include "cinder/audio/Voice.h"
 #include "cinder/audio/Source.h"
 
+#include "AtlasView.hpp"
 #include "DebugUtils.h"
+#include "Debugger.hpp"
+#include "DisplayShader.hpp"
 #include "Emulator.hpp"
+#include "FramePacer.hpp"
+#include "Phosphor.hpp"
+#include "SessionWall.hpp"
+#include "StatePublisher.hpp"
+#include "TerminalRenderer.hpp"
+#include "Trace.hpp"
 
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -17,7 +30,15 @@ using namespace ci::app;
 
 const int appDefaultWidth = 640;
 const int appDefaultHeight = 320;
-const float frameRate = 300;
+const float frameRate = 60;
+const double fastForwardMultiples[] = { 2, 4, 8, 16, 0 }; // 0: as fast as possible
+const int wallSessions = 256;
+// H cycles these (off, on): white, green and amber phosphor.
+const Color palettes[][2] = {
+    { Color(0, 0, 0),           Color(1, 1, 1) },
+    { Color(0, 0.04f, 0.02f),   Color(0.2f, 1, 0.4f) },
+    { Color(0.05f, 0.02f, 0),   Color(1, 0.7f, 0.1f) },
+};
 
 void prepareSettings(App::Settings *settings)
 {
@@ -53,6 +74,9 @@ public:
 private:
     Emulator chipEmulator;
     
+    // the display is drawn by the shader when it compiled, else from texData.
+    std::unique_ptr<DisplayShader> displayShader;
+    int paletteIndex = 0;
     uint8_t texData[32][64][3];
     gl::Texture2dRef screenTexture;
     Rectf textureBounds;
@@ -61,7 +85,32 @@ private:
     gl::TextureFontRef textureFont;
     
     bool dbgToggleSingleStepMode = false;
-    bool dbgSingleStepKeyPressed = false;
+    enum { DbgNone, DbgStep, DbgStepOver, DbgStepOut } dbgCommand = DbgNone;
+    Debugger debugger;
+    
+    TraceBuffer trace;
+    
+    FramePacer pacer;
+    int fastForwardIndex = 1;
+    
+    double inputLatencyMs = 0;  // last key event to the frame that showed its effect
+    
+    // G: many clones of the current program on worker threads, shown as one wall.
+    SessionWall wall;
+    std::unique_ptr<AtlasView> atlas;
+    
+    StatePublisher publisher;   // --publish NAME: live state for chippy-inspect
+    
+    // P: blend flicker from XOR redraws the way a CRT's slow phosphor did.
+    Phosphor phosphor;
+    bool phosphorOn() const { return chipEmulator.displaySink == &phosphor; }
+    
+    void toggleTracing();
+    void togglePhosphor();
+    void cyclePalette();
+    void toggleWall();
+    void changeFastForwardMultiple(int step);
+    void dumpTrace();
     
     void renderDisplayToTexture();
     void renderDisplayToConsole();
@@ -69,6 +118,23 @@ private:
 
 void ChippyApp::renderDisplayToTexture()
 {
+    // single steps never finish a frame, so they show the raw display.
+    bool shaded = phosphorOn() && !dbgToggleSingleStepMode;
+    if (displayShader) {
+        if (shaded)
+            displayShader->update(phosphor.pixels());
+        else
+            displayShader->update(chipEmulator);
+        return;
+    }
+    if (shaded) {
+        const uint8_t *shade = phosphor.pixels();
+        for (int y = 0; y < 32; ++y)
+            for (int x = 0; x < 64; ++x)
+                texData[y][x][0] = texData[y][x][1] = texData[y][x][2] = shade[y * 64 + x];
+        screenTexture->update(texData, GL_RGB, GL_UNSIGNED_BYTE, 0, 64, 32);
+        return;
+    }
     for (int y = 0; y < 32; ++y)
         for (int x = 0; x < 64; ++x)
             if (chipEmulator.display[y][x] == 0)
@@ -80,22 +146,91 @@ void ChippyApp::renderDisplayToTexture()
 
 void ChippyApp::renderDisplayToConsole()
 {
-    for (int y = 0; y < 32; ++y) {
-        for (int x = 0; x < 64; ++x) {
-            if (chipEmulator.display[y][x] == 0)
-                console() << " ";
-            else
-                console() << "*";
-        }
-        console() << std::endl;
+    // two rows per line, written in one go.
+    console() << TerminalRenderer::plainText(chipEmulator) << std::endl;
+}
+
+void ChippyApp::toggleTracing()
+{
+    if (chipEmulator.tracer) {
+        chipEmulator.tracer = nullptr;
+        console() << "tracing off, " << trace.recorded() << " instructions recorded" << std::endl;
     }
-    console() << std::endl;
+    else {
+        trace.clear();
+        chipEmulator.tracer = &trace;
+        console() << "tracing on" << std::endl;
+    }
+}
+
+void ChippyApp::togglePhosphor()
+{
+    // the phosphor sits in front of whatever else wants frames (the publisher).
+    if (phosphorOn()) {
+        chipEmulator.displaySink = nullptr;
+        chipEmulator.frameSink = phosphor.next;
+        console() << "phosphor off" << std::endl;
+    }
+    else {
+        phosphor.reset();
+        phosphor.next = chipEmulator.frameSink;
+        chipEmulator.displaySink = chipEmulator.frameSink = &phosphor;
+        console() << "phosphor on, decay " << phosphor.getDecay() << std::endl;
+    }
+    chipEmulator.drawDisplay = true;
+}
+
+void ChippyApp::cyclePalette()
+{
+    if (!displayShader)
+        return;
+    paletteIndex = (paletteIndex + 1) % (sizeof(palettes) / sizeof(palettes[0]));
+    displayShader->setColors(palettes[paletteIndex][0], palettes[paletteIndex][1]);
+}
+
+void ChippyApp::toggleWall()
+{
+    if (wall.running()) {
+        wall.stop();
+        atlas.reset();
+        console() << "wall off" << std::endl;
+        return;
+    }
+    // the clones start from where this program is now and diverge by their seeds.
+    wall.start(chipEmulator, wallSessions);
+    atlas.reset(new AtlasView(wallSessions));
+    if (chipSound->isPlaying())
+        chipSound->stop();
+    console() << "wall of " << wallSessions << " sessions on" << std::endl;
+}
+
+void ChippyApp::dumpTrace()
+{
+    std::string path = getHomeDirectory().string() + "/chippy.c8trace";
+    if (trace.dump(path))
+        console() << "trace written to " << path << " (decode with chippy-trace dump)" << std::endl;
+    else
+        console() << "could not write " << path << std::endl;
 }
 
 void ChippyApp::setup()
 {
-    disableFrameRate();
-    gl::enableVerticalSync(false);
+    // the pacer runs as many emulated frames per host frame as the speed asks for.
+    setFrameRate(frameRate);
+    pacer.setMultiple(fastForwardMultiples[fastForwardIndex]);
+    
+    const auto &args = getCommandLineArgs();
+    for (size_t i = 0; i + 1 < args.size(); ++i) {
+        if (args[i] != "--publish")
+            continue;
+        if (publisher.open(args[i + 1])) {
+            chipEmulator.frameSink = &publisher;
+            console() << "publishing live state at " << args[i + 1] << std::endl;
+        }
+        else
+            console() << "could not create shared memory " << args[i + 1] << std::endl;
+    }
+    togglePhosphor();
     // clear texData
     for (int y = 0; y < 32; ++y)
         for (int x = 0; x < 64; ++x)
@@ -107,6 +242,13 @@ void ChippyApp::setup()
     screenTexture->setTopDown(true);
     textureBounds = screenTexture->getBounds();
     drawBounds = textureBounds.getCenteredFit(getWindowBounds(), true);
+    try {
+        displayShader.reset(new DisplayShader);
+        drawBounds = DisplayShader::integerFit(getWindowBounds());
+    }
+    catch (const std::exception &e) {
+        console() << "display shader unavailable, drawing a texture: " << e.what() << std::endl;
+    }
     
     // setup font
     fontName = Font("Helvetica", 12);
@@ -131,111 +273,158 @@ void ChippyApp::keyDown(KeyEvent event)
 {
     switch (event.getCode()) {
         case KeyEvent::KEY_1:
-            chipEmulator.setKeyPressed(0x1);
+            chipEmulator.pushKeyEvent(0x1, true, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_2:
-            chipEmulator.setKeyPressed(0x2);
+            chipEmulator.pushKeyEvent(0x2, true, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_3:
-            chipEmulator.setKeyPressed(0x3);
+            chipEmulator.pushKeyEvent(0x3, true, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_4:
-            chipEmulator.setKeyPressed(0xC);
+            chipEmulator.pushKeyEvent(0xC, true, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_q:
-            chipEmulator.setKeyPressed(0x4);
+            chipEmulator.pushKeyEvent(0x4, true, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_w:
-            chipEmulator.setKeyPressed(0x5);
+            chipEmulator.pushKeyEvent(0x5, true, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_e:
-            chipEmulator.setKeyPressed(0x6);
+            chipEmulator.pushKeyEvent(0x6, true, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_r:
-            chipEmulator.setKeyPressed(0xD);
+            chipEmulator.pushKeyEvent(0xD, true, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_a:
-            chipEmulator.setKeyPressed(0x7);
+            chipEmulator.pushKeyEvent(0x7, true, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_s:
-            chipEmulator.setKeyPressed(0x8);
+            chipEmulator.pushKeyEvent(0x8, true, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_d:
-            chipEmulator.setKeyPressed(0x9);
+            chipEmulator.pushKeyEvent(0x9, true, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_f:
-            chipEmulator.setKeyPressed(0xE);
+            chipEmulator.pushKeyEvent(0xE, true, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_z:
-            chipEmulator.setKeyPressed(0xA);
+            chipEmulator.pushKeyEvent(0xA, true, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_x:
-            chipEmulator.setKeyPressed(0x0);
+            chipEmulator.pushKeyEvent(0x0, true, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_c:
-            chipEmulator.setKeyPressed(0xB);
+            chipEmulator.pushKeyEvent(0xB, true, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_v:
-            chipEmulator.setKeyPressed(0xF);
+            chipEmulator.pushKeyEvent(0xF, true, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_k:
-            dbgSingleStepKeyPressed = true;
+            dbgCommand = DbgStep;
+            break;
+        case KeyEvent::KEY_n:
+            dbgCommand = DbgStepOver;
+            break;
+        case KeyEvent::KEY_o:
+            dbgCommand = DbgStepOut;
+            break;
+        case KeyEvent::KEY_b:
+            debugger.setBreakpoint(chipEmulator.getPC(), !debugger.hasBreakpoint(chipEmulator.getPC()));
+            console() << "breakpoint " << (debugger.hasBreakpoint(chipEmulator.getPC()) ? "set" : "cleared")
+                      << " at 0x" << std::hex << chipEmulator.getPC() << std::dec << std::endl;
             break;
         case KeyEvent::KEY_j:
             dbgToggleSingleStepMode = !dbgToggleSingleStepMode;
+            break;
+        case KeyEvent::KEY_t:
+            toggleTracing();
+            break;
+        case KeyEvent::KEY_y:
+            dumpTrace();
+            break;
+        case KeyEvent::KEY_g:
+            toggleWall();
+            break;
+        case KeyEvent::KEY_p:
+            togglePhosphor();
+            break;
+        case KeyEvent::KEY_h:
+            cyclePalette();
+            break;
+        case KeyEvent::KEY_l:
+            if (displayShader)
+                displayShader->setScanlines(displayShader->getScanlines() > 0 ? 0 : 0.5f);
+            break;
+        case KeyEvent::KEY_TAB:
+            pacer.setFastForward(!pacer.isFastForward());
+            break;
+        case KeyEvent::KEY_RIGHTBRACKET:
+            changeFastForwardMultiple(1);
+            break;
+        case KeyEvent::KEY_LEFTBRACKET:
+            changeFastForwardMultiple(-1);
+            break;
     }
 }
 
+void ChippyApp::changeFastForwardMultiple(int step)
+{
+    const int count = sizeof(fastForwardMultiples) / sizeof(fastForwardMultiples[0]);
+    fastForwardIndex = std::max(0, std::min(count - 1, fastForwardIndex + step));
+    pacer.setMultiple(fastForwardMultiples[fastForwardIndex]);
+}
+
 void ChippyApp::keyUp(KeyEvent event)
 {
     switch (event.getCode()) {
         case KeyEvent::KEY_1:
-            chipEmulator.setKeyReleased(0x1);
+            chipEmulator.pushKeyEvent(0x1, false, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_2:
-            chipEmulator.setKeyReleased(0x2);
+            chipEmulator.pushKeyEvent(0x2, false, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_3:
-            chipEmulator.setKeyReleased(0x3);
+            chipEmulator.pushKeyEvent(0x3, false, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_4:
-            chipEmulator.setKeyReleased(0xC);
+            chipEmulator.pushKeyEvent(0xC, false, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_q:
-            chipEmulator.setKeyReleased(0x4);
+            chipEmulator.pushKeyEvent(0x4, false, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_w:
-            chipEmulator.setKeyReleased(0x5);
+            chipEmulator.pushKeyEvent(0x5, false, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_e:
-            chipEmulator.setKeyReleased(0x6);
+            chipEmulator.pushKeyEvent(0x6, false, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_r:
-            chipEmulator.setKeyReleased(0xD);
+            chipEmulator.pushKeyEvent(0xD, false, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_a:
-            chipEmulator.setKeyReleased(0x7);
+            chipEmulator.pushKeyEvent(0x7, false, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_s:
-            chipEmulator.setKeyReleased(0x8);
+            chipEmulator.pushKeyEvent(0x8, false, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_d:
-            chipEmulator.setKeyReleased(0x9);
+            chipEmulator.pushKeyEvent(0x9, false, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_f:
-            chipEmulator.setKeyReleased(0xE);
+            chipEmulator.pushKeyEvent(0xE, false, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_z:
-            chipEmulator.setKeyReleased(0xA);
+            chipEmulator.pushKeyEvent(0xA, false, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_x:
-            chipEmulator.setKeyReleased(0x0);
+            chipEmulator.pushKeyEvent(0x0, false, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_c:
-            chipEmulator.setKeyReleased(0xB);
+            chipEmulator.pushKeyEvent(0xB, false, Emulator::timestampNow());
             break;
         case KeyEvent::KEY_v:
-            chipEmulator.setKeyReleased(0xF);
+            chipEmulator.pushKeyEvent(0xF, false, Emulator::timestampNow());
             break;
     }
 }
@@ -244,42 +433,67 @@ void ChippyApp::fileDrop(FileDropEvent event)
 {
     auto file = event.getFile(0);
     chipEmulator.reset();
+    phosphor.reset();
     if (!chipEmulator.loadBinary(file.string()))
         console() << "could not load " << file.string() << std::endl;
 }
 
 void ChippyApp::resize()
 {
-    drawBounds = textureBounds.getCenteredFit(getWindowBounds(), true);
+    if (displayShader)
+        drawBounds = DisplayShader::integerFit(getWindowBounds());
+    else
+        drawBounds = textureBounds.getCenteredFit(getWindowBounds(), true);
 }
 
 void ChippyApp::update()
 {
+    // the wall runs on its own threads; this program is paused meanwhile.
+    if (atlas) {
+        atlas->update(wall);
+        return;
+    }
+    
 #if debug
+    // the debugger drives the emulator here; release builds never go through it.
     if (dbgToggleSingleStepMode) {
-        if (dbgSingleStepKeyPressed) {
-            chipEmulator.cpuCycle();
-            if (chipEmulator.drawDisplay) {
-                renderDisplayToTexture();
-                chipEmulator.drawDisplay = false;
-            }
+        if (dbgCommand != DbgNone) {
+            Debugger::Stop stop = dbgCommand == DbgStep     ? debugger.step(chipEmulator)
+                                : dbgCommand == DbgStepOver ? debugger.stepOver(chipEmulator, 100000000)
+                                                            : debugger.stepOut(chipEmulator, 100000000);
+            if (stop != Debugger::Stop::Step)
+                console() << "stopped: " << Debugger::stopName(stop) << std::endl;
+            console() << Debugger::describeState(chipEmulator) << std::endl;
         }
-        dbgSingleStepKeyPressed = false;
+        dbgCommand = DbgNone;
     }
     else {
-        chipEmulator.cpuCycle();
-        if (chipEmulator.drawDisplay) {
-            renderDisplayToTexture();
-            chipEmulator.drawDisplay = false;
+        // paced like the release build, so Tab and [ ] work here too.
+        Debugger::Stop stop = Debugger::Stop::None;
+        pacer.advance(chipEmulator, 1.0 / frameRate, [&](Emulator &emulator) {
+            stop = debugger.runFrame(emulator);
+            return stop == Debugger::Stop::None;
+        });
+        if (stop != Debugger::Stop::None) {
+            dbgToggleSingleStepMode = true;
+            console() << "stopped: " << Debugger::stopName(stop) << std::endl
+                      << Debugger::describeState(chipEmulator) << std::endl;
         }
     }
+    if (chipEmulator.drawDisplay || (phosphorOn() && phosphor.changed())) {
+        renderDisplayToTexture();
+        chipEmulator.drawDisplay = false;
+    }
 #else
-    chipEmulator.cpuCycle();
-    if (chipEmulator.drawDisplay) {
+    // however many frames ran, the texture is uploaded at most once per host frame.
+    pacer.advance(chipEmulator, 1.0 / frameRate);
+    // a fading phosphor keeps changing after the program stops drawing.
+    if (chipEmulator.drawDisplay || (phosphorOn() && phosphor.changed())) {
         renderDisplayToTexture();
         chipEmulator.drawDisplay = false;
     }
-    if (chipEmulator.makeSound()) {
+    // the tone would only stutter at a multiple of its speed; fast-forward is silent.
+    if (chipEmulator.makeSound() && !pacer.isFastForward()) {
         if (!chipSound->isPlaying())
             chipSound->start();
     }
@@ -296,7 +510,8 @@ void ChippyApp::update()
     static double t60 = 0;
     double t60elapsed = getElapsedSeconds() - t60;
     if (t60elapsed >= 1) {
-        console() << chipEmulator.statInstructionCount << " Instructions executed in " << t60elapsed << " seconds" << std::endl;
+        console() << chipEmulator.statInstructionCount << " Instructions executed in " << t60elapsed << " seconds, "
+                  << "input latency " << inputLatencyMs << " ms" << std::endl;
         chipEmulator.statInstructionCount = 0;
         t60 = getElapsedSeconds();
     }
@@ -310,12 +525,38 @@ void ChippyApp::draw()
     gl::setMatricesWindow(getWindowSize());
     
     gl::clear(Color(0, 0, 0));
-    gl::draw(screenTexture, drawBounds);
+    if (atlas)
+        atlas->draw(atlas->getBounds().getCenteredFit(getWindowBounds(), true));
+    else if (displayShader)
+        displayShader->draw(drawBounds);
+    else
+        gl::draw(screenTexture, drawBounds);
+    
+    // keys are queued with their arrival time; this frame is the first to show what they did.
+    if (uint64_t pressed = chipEmulator.takeShownInputTimestamp())
+        inputLatencyMs = (Emulator::timestampNow() - pressed) / 1e6;
+    
+    if (pacer.isFastForward()) {
+        char speed[64];
+        if (pacer.getMultiple() > 0)
+            snprintf(speed, sizeof(speed), ">> x%g (%.1fx)", pacer.getMultiple(), pacer.achievedMultiple());
+        else
+            snprintf(speed, sizeof(speed), ">> max (%.1fx)", pacer.achievedMultiple());
+        gl::enableAlphaBlending();
+        gl::color(ColorA(1.0f, 1.0f, 0.0f, 0.9f));
+        textureFont->drawString(speed, vec2(10, textureFont->getAscent() + 10));
+        gl::disableAlphaBlending();
+        gl::color(Color(1, 1, 1));
+    }
 
 #if debug
     gl::enableAlphaBlending();
     gl::color(ColorA(0.0f, 1.0f, 0.0f, 0.9f));
-    std::string debugModeStr = "press J to enable/disable single step mode\npress K to single step";
+    std::string debugModeStr = "press J to enable/disable single step mode\npress K to single step, N to step over, O to step out\n"
+                               "press B to toggle a breakpoint at the current pc\n"
+                               "press T to start/stop tracing, Y to dump the trace\n"
+                               "press Tab to fast-forward, [ and ] to change its speed\n"
+                               "press G to show/hide a wall of clones";
     float fontNameWidth = textureFont->measureString(debugModeStr).x;
     textureFont->drawString(debugModeStr, vec2(getWindowWidth()-fontNameWidth-10,
                                                getWindowHeight()-textureFont->getDescent()-15));
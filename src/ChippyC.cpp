@@ -0,0 +1,326 @@
+//
+//  ChippyC.cpp
+//  Chippy
+//
+//  Implementation of the C ABI in include/chippy.h.
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Emulator.hpp"
+#include "chippy.h"
+
+namespace {
+
+const size_t packedObservationSize = displayHeight * displayWidth / 8;
+const size_t byteObservationSize = displayHeight * displayWidth;
+
+struct RewardHook {
+    bool isRegister;
+    uint16_t index;
+    float scale;
+    chippy_reward_mode mode;
+};
+
+struct Env {
+    Emulator emulator;
+    std::vector<uint8_t> before; // hook values at the start of a step, sized once when hooks change
+};
+
+// Persistent workers; the calling thread joins in, so a 1-thread pool never context switches.
+class StepWorkers
+{
+public:
+    explicit StepWorkers(unsigned count)
+    {
+        for (unsigned i = 1; i < count; ++i)
+            threads.emplace_back(&StepWorkers::loop, this);
+    }
+
+    ~StepWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &t : threads)
+            t.join();
+    }
+
+    // runs job(i) for every i in [0, n), in chunks, on all workers.
+    template <typename Job>
+    void run(uint32_t n, const Job &job)
+    {
+        if (threads.empty() || n < 2) {
+            for (uint32_t i = 0; i < n; ++i)
+                job(i);
+            return;
+        }
+        Task task = [&job](uint32_t i) { job(i); };
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = &task;
+            count = n;
+            chunk = std::max<uint32_t>(1, n / (uint32_t)((threads.size() + 1) * 4));
+            next = 0;
+            active = (unsigned)threads.size();
+            ++generation;
+        }
+        wake.notify_all();
+        work();
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this] { return active == 0; });
+        current = nullptr;
+    }
+
+private:
+    typedef std::function<void(uint32_t)> Task;
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, finished;
+    const Task *current = nullptr;
+    uint32_t count = 0, chunk = 1;
+    std::atomic<uint32_t> next {0};
+    unsigned active = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    void work()
+    {
+        for (;;) {
+            uint32_t begin = next.fetch_add(chunk);
+            if (begin >= count)
+                return;
+            uint32_t end = std::min(count, begin + chunk);
+            for (uint32_t i = begin; i < end; ++i)
+                (*current)(i);
+        }
+    }
+
+    void loop()
+    {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+            }
+            work();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--active == 0)
+                finished.notify_one();
+        }
+    }
+};
+
+} // namespace
+
+struct chippy_pool {
+    std::vector<std::unique_ptr<Env>> envs;
+    std::unique_ptr<Emulator> boot;   // template every env is cloned from on reset
+    uint32_t seed = 0;
+    std::vector<RewardHook> hooks;
+    void *observations = nullptr;
+    chippy_obs_format format = CHIPPY_OBS_PACKED_BITS;
+    float *rewards = nullptr;
+    uint8_t *done = nullptr;
+    std::unique_ptr<StepWorkers> workers;
+};
+
+namespace {
+
+uint8_t hookValue(const Emulator &emu, const RewardHook &hook)
+{
+    return hook.isRegister ? emu.getV(hook.index) : emu.peekMemory(hook.index);
+}
+
+void observe(chippy_pool *pool, uint32_t i)
+{
+    if (pool->done)
+        pool->done[i] = pool->envs[i]->emulator.halted ? 1 : 0;
+    if (!pool->observations)
+        return;
+    const Emulator &emu = pool->envs[i]->emulator;
+    auto *base = static_cast<uint8_t*>(pool->observations);
+    if (pool->format == CHIPPY_OBS_PACKED_BITS)
+        emu.packDisplay(base + i * packedObservationSize);
+    else
+        std::memcpy(base + i * byteObservationSize, emu.display, byteObservationSize);
+}
+
+void resetEnv(chippy_pool *pool, uint32_t i)
+{
+    Emulator &emu = pool->envs[i]->emulator;
+    emu.cloneFrom(*pool->boot);
+    emu.seedRandom(pool->seed + i);
+    observe(pool, i);
+}
+
+} // namespace
+
+extern "C" {
+
+int chippy_abi_version(void)
+{
+    return CHIPPY_ABI_VERSION;
+}
+
+chippy_pool *chippy_pool_create(const uint8_t *rom, size_t romSize, uint32_t numEnvs, uint32_t seed,
+                                uint32_t numThreads)
+{
+    if (!rom || numEnvs == 0)
+        return nullptr;
+    std::unique_ptr<chippy_pool> pool(new chippy_pool);
+
+    // boot once, then every env (and every later reset) is a copy-on-write clone of it.
+    pool->boot.reset(new Emulator);
+    if (!pool->boot->loadBinary(rom, romSize))
+        return nullptr;
+    pool->seed = seed;
+
+    pool->envs.reserve(numEnvs);
+    for (uint32_t i = 0; i < numEnvs; ++i)
+        pool->envs.emplace_back(new Env);
+    for (uint32_t i = 0; i < numEnvs; ++i)
+        resetEnv(pool.get(), i);
+
+    unsigned threads = numThreads ? numThreads : std::max(1u, std::thread::hardware_concurrency());
+    pool->workers.reset(new StepWorkers(std::min<unsigned>(threads, numEnvs)));
+    return pool.release();
+}
+
+void chippy_pool_destroy(chippy_pool *pool)
+{
+    delete pool;
+}
+
+uint32_t chippy_pool_size(const chippy_pool *pool)
+{
+    return (uint32_t)pool->envs.size();
+}
+
+void chippy_set_instructions_per_frame(chippy_pool *pool, uint32_t instructions)
+{
+    pool->boot->instructionsPerFrame = (int)std::max<uint32_t>(1, instructions);
+    for (auto &env : pool->envs)
+        env->emulator.instructionsPerFrame = pool->boot->instructionsPerFrame;
+}
+
+void chippy_advance_boot(chippy_pool *pool, uint32_t frames, uint16_t keyMask)
+{
+    Emulator &boot = *pool->boot;
+    boot.seedRandom(pool->seed);
+    boot.setKeyMask(keyMask);
+    for (uint32_t f = 0; f < frames && !boot.halted; ++f)
+        boot.runFrame();
+    boot.setKeyMask(0);
+}
+
+size_t chippy_observation_size(chippy_obs_format format)
+{
+    return format == CHIPPY_OBS_BYTES ? byteObservationSize : packedObservationSize;
+}
+
+void chippy_set_observation_buffer(chippy_pool *pool, void *observations, chippy_obs_format format)
+{
+    pool->observations = observations;
+    pool->format = format;
+    for (uint32_t i = 0; i < pool->envs.size(); ++i)
+        observe(pool, i);
+}
+
+void chippy_set_reward_buffer(chippy_pool *pool, float *rewards)
+{
+    pool->rewards = rewards;
+}
+
+void chippy_set_done_buffer(chippy_pool *pool, uint8_t *done)
+{
+    pool->done = done;
+    for (uint32_t i = 0; i < pool->envs.size(); ++i)
+        observe(pool, i);
+}
+
+static int addHook(chippy_pool *pool, bool isRegister, uint16_t index, float scale, chippy_reward_mode mode)
+{
+    if (mode != CHIPPY_REWARD_VALUE && mode != CHIPPY_REWARD_DELTA)
+        return -1;
+    pool->hooks.push_back({ isRegister, index, scale, mode });
+    for (auto &env : pool->envs)
+        env->before.resize(pool->hooks.size());
+    return 0;
+}
+
+int chippy_add_memory_reward(chippy_pool *pool, uint16_t address, float scale, chippy_reward_mode mode)
+{
+    if (address >= 0x1000)
+        return -1;
+    return addHook(pool, false, address, scale, mode);
+}
+
+int chippy_add_register_reward(chippy_pool *pool, uint8_t reg, float scale, chippy_reward_mode mode)
+{
+    if (reg >= 16)
+        return -1;
+    return addHook(pool, true, reg, scale, mode);
+}
+
+void chippy_clear_rewards(chippy_pool *pool)
+{
+    pool->hooks.clear();
+}
+
+void chippy_reset(chippy_pool *pool, int32_t env)
+{
+    if (env >= 0) {
+        if ((uint32_t)env < pool->envs.size())
+            resetEnv(pool, (uint32_t)env);
+        return;
+    }
+    pool->workers->run((uint32_t)pool->envs.size(), [pool](uint32_t i) { resetEnv(pool, i); });
+}
+
+void chippy_step(chippy_pool *pool, const uint16_t *actions, uint32_t frames)
+{
+    pool->workers->run((uint32_t)pool->envs.size(), [pool, actions, frames](uint32_t i) {
+        Env &env = *pool->envs[i];
+        Emulator &emu = env.emulator;
+        const auto &hooks = pool->hooks;
+        for (size_t h = 0; h < hooks.size(); ++h)
+            env.before[h] = hookValue(emu, hooks[h]);
+
+        emu.setKeyMask(actions ? actions[i] : 0);
+        for (uint32_t f = 0; f < frames; ++f)
+            emu.runFrame();
+
+        if (pool->rewards) {
+            float reward = 0;
+            for (size_t h = 0; h < hooks.size(); ++h) {
+                uint8_t after = hookValue(emu, hooks[h]);
+                if (hooks[h].mode == CHIPPY_REWARD_DELTA)
+                    reward += hooks[h].scale * (float)(int8_t)(uint8_t)(after - env.before[h]);
+                else
+                    reward += hooks[h].scale * after;
+            }
+            pool->rewards[i] = reward;
+        }
+        observe(pool, i);
+    });
+}
+
+} // extern "C"
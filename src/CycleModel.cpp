@@ -0,0 +1,62 @@
+//
+//  CycleModel.cpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include "CycleModel.hpp"
+
+namespace {
+
+// COSMAC VIP interpreter, approximate. About 40 cycles of every entry are
+// the fetch and the dispatch through the interpreter's jump table; the
+// arithmetic 8xy_ forms assemble and run a small 1802 routine, hence the cost.
+const CycleModel::Cost vipCosts[CycleModel::classCount] = {
+    { "00E0", 3104, 0,  0,  nullptr },
+    { "00EE",   50, 0,  0,  nullptr },
+    { "0nnn",   40, 0,  0,  nullptr },      // machine code: not run here
+    { "1nnn",   52, 0,  0,  nullptr },
+    { "2nnn",   66, 0,  0,  nullptr },
+    { "3xkk",   50, 4,  0,  nullptr },
+    { "4xkk",   50, 4,  0,  nullptr },
+    { "5xy0",   54, 4,  0,  nullptr },
+    { "6xkk",   46, 0,  0,  nullptr },
+    { "7xkk",   50, 0,  0,  nullptr },
+    { "8xy0",   52, 0,  0,  nullptr },
+    { "8xy1",   84, 0,  0,  nullptr },
+    { "8xy2",   84, 0,  0,  nullptr },
+    { "8xy3",   84, 0,  0,  nullptr },
+    { "8xy4",   84, 0,  0,  nullptr },
+    { "8xy5",   84, 0,  0,  nullptr },
+    { "8xy6",   84, 0,  0,  nullptr },
+    { "8xy7",   84, 0,  0,  nullptr },
+    { "8xyE",   84, 0,  0,  nullptr },
+    { "9xy0",   54, 4,  0,  nullptr },
+    { "Annn",   52, 0,  0,  nullptr },
+    { "Bnnn",   62, 0,  0,  nullptr },
+    { "Cxkk",   76, 0,  0,  nullptr },
+    { "Dxyn",   66, 0, 46,  "row" },
+    { "Ex9E",   54, 4,  0,  nullptr },
+    { "ExA1",   54, 4,  0,  nullptr },
+    { "Fx07",   50, 0,  0,  nullptr },
+    { "Fx0A",   50, 0,  0,  nullptr },      // then idles until the key
+    { "Fx15",   50, 0,  0,  nullptr },
+    { "Fx18",   50, 0,  0,  nullptr },
+    { "Fx1E",   56, 0,  0,  nullptr },
+    { "Fx29",   56, 0,  0,  nullptr },
+    { "Fx33",  120, 0,  8,  "decimal digit value" },
+    { "Fx55",   54, 0, 14,  "register" },
+    { "Fx65",   54, 0, 14,  "register" },
+    { "invalid", 40, 0, 0,  nullptr },
+};
+
+} // namespace
+
+const CycleModel &CycleModel::vip()
+{
+    // 1.7609 MHz; the 1861 fetches 8 bytes on each of 128 lines by DMA, and
+    // the interrupt that sets it up and counts the timers takes about 46 more.
+    static const CycleModel model = { "cosmac-vip", 1760900.0, 8, 1024 + 46, true, vipCosts };
+    return model;
+}
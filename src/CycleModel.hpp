@@ -0,0 +1,136 @@
+//
+//  CycleModel.hpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef CycleModel_hpp
+#define CycleModel_hpp
+
+#include <cstdint>
+
+// What each instruction costs on a given machine, in CPU machine cycles.
+//
+// Attached as Emulator::cycleModel, runFrame() spends a frame's worth of
+// cycles instead of instructionsPerFrame instructions and counts the timers
+// down once per frame, as the real interrupt did. The table is plain data so
+// tools can print it or use it to predict how fast a ROM must run.
+//
+// vip() approximates the COSMAC VIP interpreter: an 1802 at 1.76 MHz (8
+// clocks per machine cycle), minus the time the 1861 takes for display DMA
+// and the interrupt routine, with costs that include the interpreter's fetch
+// and dispatch. Dxyn waits for the next frame before it draws, so a draw
+// ends the frame; 00E0 clears 256 bytes and takes most of one.
+struct CycleModel {
+    struct Cost {
+        const char *pattern;    // "Dxyn"
+        uint16_t base;          // machine cycles, fetch and dispatch included
+        uint16_t taken;         // extra when a skip is taken
+        uint16_t perUnit;       // extra per unit, see unit
+        const char *unit;       // "row", "register", ...; null if none
+    };
+
+    enum Class {
+        Cls, Ret, Sys, Jp, Call, SeByte, SneByte, SeReg, LdByte, AddByte,
+        LdReg, Or, And, Xor, AddReg, Sub, Shr, Subn, Shl, SneReg,
+        LdI, JpV0, Rnd, Drw, Skp, Sknp, LdVDt, LdVK, LdDtV, LdStV, AddIV,
+        LdFV, LdBV, LdMemV, LdVMem, Invalid, classCount
+    };
+
+    const char *name;
+    double clockHz;             // CPU clock
+    int clocksPerCycle;         // clock periods per machine cycle
+    int frameOverhead;          // machine cycles per frame the program never gets (DMA, interrupt)
+    bool drawWaitsForFrame;     // Dxyn ends the frame
+    const Cost *costs;          // classCount entries, indexed by Class
+
+    static const CycleModel &vip();
+
+    static Class classify(uint16_t opcode);
+    // vx: Vx before the instruction ran (Dxyn's x position, Fx33's digits).
+    uint32_t cost(uint16_t opcode, bool skipTaken, uint8_t vx) const;
+    // machine cycles a 60 Hz frame leaves for the program.
+    int frameBudget() const;
+};
+
+// per-class totals, collected while attached as Emulator::cycleProfile.
+struct CycleProfile {
+    uint64_t count[CycleModel::classCount] = {};
+    uint64_t cycles[CycleModel::classCount] = {};
+    uint64_t frames = 0;
+    uint64_t drawWaits = 0;     // frames a Dxyn ended early
+    uint64_t idleFrames = 0;    // frames spent in Fx0A or halted
+};
+
+// inline: the emulator prices every instruction with these.
+inline CycleModel::Class CycleModel::classify(const uint16_t opcode)
+{
+    const uint8_t kk = opcode & 0xFF;
+    switch (opcode >> 12) {
+        case 0x0:
+            return opcode == 0x00E0 ? Cls : opcode == 0x00EE ? Ret : Sys;
+        case 0x1: return Jp;
+        case 0x2: return Call;
+        case 0x3: return SeByte;
+        case 0x4: return SneByte;
+        case 0x5: return (opcode & 0xF) == 0 ? SeReg : Invalid;
+        case 0x6: return LdByte;
+        case 0x7: return AddByte;
+        case 0x8:
+            switch (opcode & 0xF) {
+                case 0x0: return LdReg;
+                case 0x1: return Or;
+                case 0x2: return And;
+                case 0x3: return Xor;
+                case 0x4: return AddReg;
+                case 0x5: return Sub;
+                case 0x6: return Shr;
+                case 0x7: return Subn;
+                case 0xE: return Shl;
+                default:  return Invalid;
+            }
+        case 0x9: return (opcode & 0xF) == 0 ? SneReg : Invalid;
+        case 0xA: return LdI;
+        case 0xB: return JpV0;
+        case 0xC: return Rnd;
+        case 0xD: return Drw;
+        case 0xE: return kk == 0x9E ? Skp : kk == 0xA1 ? Sknp : Invalid;
+        default:
+            switch (kk) {
+                case 0x07: return LdVDt;
+                case 0x0A: return LdVK;
+                case 0x15: return LdDtV;
+                case 0x18: return LdStV;
+                case 0x1E: return AddIV;
+                case 0x29: return LdFV;
+                case 0x33: return LdBV;
+                case 0x55: return LdMemV;
+                case 0x65: return LdVMem;
+                default:   return Invalid;
+            }
+    }
+}
+
+inline uint32_t CycleModel::cost(const uint16_t opcode, const bool skipTaken, const uint8_t vx) const
+{
+    const Class c = classify(opcode);
+    const Cost &k = costs[c];
+    uint32_t cycles = k.base + (skipTaken ? k.taken : 0);
+    if (!k.perUnit)
+        return cycles;
+    switch (c) {
+        case Drw:    return cycles + k.perUnit * (opcode & 0xF);
+        case LdBV:   return cycles + k.perUnit * (vx / 100 + vx / 10 % 10 + vx % 10);
+        case LdMemV:
+        case LdVMem: return cycles + k.perUnit * (((opcode >> 8) & 0xF) + 1);
+        default:     return cycles;
+    }
+}
+
+inline int CycleModel::frameBudget() const
+{
+    return (int)(clockHz / clocksPerCycle / 60.0) - frameOverhead;
+}
+
+#endif /* CycleModel_hpp */
@@ -10,7 +10,7 @@
 #define DebugUtils_h
 
 
-#define debug 0 // toggle to enable debug print outs.
+#define debug 0 // toggle to enable debug print outs. (per-instruction tracing lives in Trace.hpp)
 
 #define __NOT_IMPLEMENTED__ assert(true);
 #define __NOT_IMPLEMENTED_CONTINUE__ return;
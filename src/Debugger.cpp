@@ -0,0 +1,378 @@
+//
+//  Debugger.cpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include "Debugger.hpp"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Disassembler.hpp"
+#include "Emulator.hpp"
+
+namespace {
+
+bool compare(uint16_t a, Debugger::Condition::Compare cmp, uint16_t b)
+{
+    switch (cmp) {
+        case Debugger::Condition::EQ: return a == b;
+        case Debugger::Condition::NE: return a != b;
+        case Debugger::Condition::LT: return a < b;
+        case Debugger::Condition::LE: return a <= b;
+        case Debugger::Condition::GT: return a > b;
+        case Debugger::Condition::GE: return a >= b;
+    }
+    return false;
+}
+
+const char *compareNames[] = { "==", "!=", "<", "<=", ">", ">=" };
+
+} // namespace
+
+bool Debugger::parseCondition(const std::string &text, Condition &c)
+{
+    const char *p = text.c_str();
+    auto skip = [&]() { while (std::isspace((unsigned char)*p)) ++p; };
+    skip();
+    char *end;
+    if ((*p == 'V' || *p == 'v') && std::isxdigit((unsigned char)p[1])) {
+        c.source = Condition::Register;
+        c.index = (uint16_t)std::strtoul(p + 1, &end, 16);
+        if (c.index > 0xF)
+            return false;
+        p = end;
+    }
+    else if (*p == '[') {
+        c.source = Condition::Memory;
+        c.index = (uint16_t)std::strtoul(p + 1, &end, 0);
+        if (*end != ']' || c.index > 0xFFF)
+            return false;
+        p = end + 1;
+    }
+    else if ((p[0] == 'P' || p[0] == 'p') && (p[1] == 'C' || p[1] == 'c')) {
+        c.source = Condition::ProgramCounter;
+        p += 2;
+    }
+    else if ((p[0] == 'D' || p[0] == 'd') && (p[1] == 'T' || p[1] == 't')) {
+        c.source = Condition::DelayTimer;
+        p += 2;
+    }
+    else if ((p[0] == 'S' || p[0] == 's') && (p[1] == 'T' || p[1] == 't')) {
+        c.source = Condition::SoundTimer;
+        p += 2;
+    }
+    else if (*p == 'I' || *p == 'i') {
+        c.source = Condition::IndexRegister;
+        ++p;
+    }
+    else {
+        return false;
+    }
+    skip();
+    static const struct { const char *text; Condition::Compare cmp; } ops[] = {
+        { "==", Condition::EQ }, { "!=", Condition::NE }, { "<=", Condition::LE },
+        { ">=", Condition::GE }, { "<", Condition::LT }, { ">", Condition::GT }
+    };
+    bool found = false;
+    for (auto &op : ops) {
+        size_t n = std::char_traits<char>::length(op.text);
+        if (text.compare(p - text.c_str(), n, op.text) == 0) {
+            c.compare = op.cmp;
+            p += n;
+            found = true;
+            break;
+        }
+    }
+    if (!found)
+        return false;
+    skip();
+    c.value = (uint16_t)std::strtoul(p, &end, 0);
+    if (end == p)
+        return false;
+    p = end;
+    skip();
+    return *p == '\0';
+}
+
+std::string Debugger::describe(const Condition &c)
+{
+    char lhs[16];
+    switch (c.source) {
+        case Condition::Register:       std::snprintf(lhs, sizeof(lhs), "V%X", c.index); break;
+        case Condition::IndexRegister:  std::snprintf(lhs, sizeof(lhs), "I"); break;
+        case Condition::Memory:         std::snprintf(lhs, sizeof(lhs), "[0x%03X]", c.index); break;
+        case Condition::ProgramCounter: std::snprintf(lhs, sizeof(lhs), "PC"); break;
+        case Condition::DelayTimer:     std::snprintf(lhs, sizeof(lhs), "DT"); break;
+        case Condition::SoundTimer:     std::snprintf(lhs, sizeof(lhs), "ST"); break;
+    }
+    char buf[48];
+    std::snprintf(buf, sizeof(buf), "%s %s 0x%X", lhs, compareNames[c.compare], c.value);
+    return buf;
+}
+
+const char *Debugger::stopName(Stop stop)
+{
+    switch (stop) {
+        case Stop::None:       return "budget";
+        case Stop::Step:       return "step";
+        case Stop::Breakpoint: return "breakpoint";
+        case Stop::ReadWatch:  return "read watchpoint";
+        case Stop::WriteWatch: return "write watchpoint";
+        case Stop::Condition:  return "condition";
+        case Stop::KeyWait:    return "waiting for key";
+        case Stop::Halted:     return "halted";
+    }
+    return "?";
+}
+
+void Debugger::setWatch(uint16_t address, uint16_t length, bool read, bool write, bool on)
+{
+    for (uint32_t a = address; a < (uint32_t)address + length; ++a) {
+        if (read)
+            readWatch[a & 0xFFF] = on;
+        if (write)
+            writeWatch[a & 0xFFF] = on;
+    }
+}
+
+void Debugger::addCondition(const Condition &c)
+{
+    conditions.push_back(c);
+    conditionState.push_back(false);
+}
+
+void Debugger::clearAll()
+{
+    breakpoints.reset();
+    readWatch.reset();
+    writeWatch.reset();
+    clearConditions();
+}
+
+bool Debugger::holds(const Emulator &emu, const Condition &c)
+{
+    return compare(valueOf(emu, c), c.compare, c.value);
+}
+
+uint16_t Debugger::valueOf(const Emulator &emu, const Condition &c)
+{
+    switch (c.source) {
+        case Condition::Register:       return emu.vReg[c.index & 0xF];
+        case Condition::IndexRegister:  return emu.I;
+        case Condition::Memory:         return emu.readMemory(c.index & 0xFFF);
+        case Condition::ProgramCounter: return emu.pc;
+        case Condition::DelayTimer:     return emu.delayTimer;
+        case Condition::SoundTimer:     return emu.soundTimer;
+    }
+    return 0;
+}
+
+bool Debugger::anythingSet() const
+{
+    return breakpoints.any() || readWatch.any() || writeWatch.any() || !conditions.empty();
+}
+
+Debugger::Stop Debugger::checkBefore(const Emulator &emu)
+{
+    uint16_t pc = emu.pc;
+    if (breakpoints[pc & 0xFFF]) {
+        stopAddress = pc;
+        return Stop::Breakpoint;
+    }
+    if (pc >= 0xFFF)
+        return Stop::None;
+
+    // which memory the instruction at pc is about to touch.
+    uint16_t opcode = (emu.readMemory(pc) << 8) | emu.readMemory(pc + 1);
+    unsigned x = (opcode >> 8) & 0xF, kk = opcode & 0xFF;
+    const std::bitset<0x1000> *watch = nullptr;
+    unsigned length = 0;
+    if ((opcode >> 12) == 0xD) {
+        watch = &readWatch;
+        length = opcode & 0xF;
+    }
+    else if ((opcode >> 12) == 0xF) {
+        if (kk == 0x65) {
+            watch = &readWatch;
+            length = x + 1;
+        }
+        else if (kk == 0x55) {
+            watch = &writeWatch;
+            length = x + 1;
+        }
+        else if (kk == 0x33) {
+            watch = &writeWatch;
+            length = 3;
+        }
+    }
+    for (unsigned i = 0; watch && i < length; ++i) {
+        uint16_t a = (emu.I + i) & 0xFFF;
+        if ((*watch)[a]) {
+            stopAddress = a;
+            return watch == &readWatch ? Stop::ReadWatch : Stop::WriteWatch;
+        }
+    }
+    return Stop::None;
+}
+
+void Debugger::primeConditions(const Emulator &emu)
+{
+    for (size_t i = 0; i < conditions.size(); ++i) {
+        auto &c = conditions[i];
+        conditionState[i] = compare(valueOf(emu, c), c.compare, c.value);
+    }
+}
+
+bool Debugger::conditionHit(const Emulator &emu)
+{
+    bool hit = false;
+    for (size_t i = 0; i < conditions.size(); ++i) {
+        auto &c = conditions[i];
+        bool now = compare(valueOf(emu, c), c.compare, c.value);
+        if (now && !conditionState[i])
+            hit = true;
+        conditionState[i] = now;
+    }
+    return hit;
+}
+
+// where the next run() or runFrame() may pass the checks once.
+Debugger::Stop Debugger::stopped(const Emulator &emu, Stop stop)
+{
+    resumeAt = stop == Stop::None ? -1 : emu.pc;
+    return stop;
+}
+
+template <typename Done>
+Debugger::Stop Debugger::runUntil(Emulator &emu, uint64_t maxInstructions, bool checkFirst, const Done &done)
+{
+    primeConditions(emu);
+    for (uint64_t i = 0; i < maxInstructions; ++i) {
+        if (emu.halted)
+            return stopped(emu, Stop::Halted);
+        // nothing would run for the rest of the budget.
+        if (emu.waitForKey && !emu.inputPending())
+            return stopped(emu, Stop::KeyWait);
+        if (i > 0 || checkFirst) {
+            Stop stop = checkBefore(emu);
+            if (stop != Stop::None)
+                return stopped(emu, stop);
+        }
+        emu.execute<true>();
+        if (!conditions.empty() && conditionHit(emu))
+            return stopped(emu, Stop::Condition);
+        if (done(emu))
+            return stopped(emu, Stop::Step);
+    }
+    return stopped(emu, emu.halted ? Stop::Halted : Stop::None);
+}
+
+Debugger::Stop Debugger::step(Emulator &emu)
+{
+    return runUntil(emu, 1, false, [](const Emulator&) { return true; });
+}
+
+Debugger::Stop Debugger::stepOver(Emulator &emu, uint64_t maxInstructions)
+{
+    uint16_t pc = emu.pc;
+    bool isCall = pc < 0xFFF && (emu.readMemory(pc) >> 4) == 0x2;
+    if (!isCall)
+        return step(emu);
+    // run the whole subroutine: until we are back at this depth, after the call.
+    int8_t depth = emu.sp;
+    uint16_t returnAddress = pc + 2;
+    return runUntil(emu, maxInstructions, false, [depth, returnAddress](const Emulator &e) {
+        return e.sp == depth && e.pc == returnAddress;
+    });
+}
+
+Debugger::Stop Debugger::stepOut(Emulator &emu, uint64_t maxInstructions)
+{
+    int8_t depth = emu.sp;
+    if (depth < 0)
+        return runUntil(emu, maxInstructions, false, [](const Emulator&) { return false; });
+    return runUntil(emu, maxInstructions, false, [depth](const Emulator &e) { return e.sp < depth; });
+}
+
+Debugger::Stop Debugger::run(Emulator &emu, uint64_t maxInstructions)
+{
+    if (!anythingSet()) {
+        // nothing to check for: full speed through the plain loop.
+        for (uint64_t i = 0; i < maxInstructions && !emu.halted; ++i) {
+            if (emu.waitForKey && !emu.inputPending())
+                return stopped(emu, Stop::KeyWait);
+            emu.execute<false>();
+        }
+        return stopped(emu, emu.halted ? Stop::Halted : Stop::None);
+    }
+    return runUntil(emu, maxInstructions, emu.pc != resumeAt, [](const Emulator&) { return false; });
+}
+
+Debugger::Stop Debugger::runFrame(Emulator &emu)
+{
+    Stop stop;
+    if (!emu.cycleModel) {
+        stop = run(emu, (uint64_t)emu.instructionsPerFrame);
+        if (stop == Stop::KeyWait)
+            stop = stopped(emu, Stop::None);
+        emu.frameDone();
+    }
+    else if (!anythingSet()) {
+        emu.runCycles();
+        stop = stopped(emu, emu.halted ? Stop::Halted : Stop::None);
+    }
+    else {
+        // the model's cycle budget, with runUntil()'s checks around each instruction.
+        struct Frame {
+            Debugger *debugger;
+            bool check;
+            Stop stop;
+        } frame = { this, emu.pc != resumeAt, Stop::None };
+        primeConditions(emu);
+        // a stop cuts the frame short; the next call starts a new one.
+        if (!emu.runCycles([](Emulator &e, void *context) {
+            Frame &f = *static_cast<Frame*>(context);
+            if (f.check && (f.stop = f.debugger->checkBefore(e)) != Stop::None)
+                return false;
+            f.check = true;
+            e.execute<true, true>();
+            if (!f.debugger->conditions.empty() && f.debugger->conditionHit(e)) {
+                f.stop = Stop::Condition;
+                return false;
+            }
+            return true;
+        }, &frame))
+            emu.frameDone();
+        stop = stopped(emu, frame.stop != Stop::None ? frame.stop : emu.halted ? Stop::Halted : Stop::None);
+    }
+    if (emu.frameSink)
+        emu.frameSink->frameComplete(emu);
+    return stop;
+}
+
+std::string Debugger::describeState(const Emulator &emu)
+{
+    char buf[256];
+    std::string out;
+    uint16_t opcode = emu.pc < 0xFFF ? (emu.readMemory(emu.pc) << 8) | emu.readMemory(emu.pc + 1) : 0;
+    std::snprintf(buf, sizeof(buf), "PC=%03X  %04X  %-18s I=%03X  DT=%02X ST=%02X  SP=%d%s%s\n", emu.pc, opcode,
+                  disassemble(opcode).c_str(), emu.I, emu.delayTimer, emu.soundTimer, emu.sp,
+                  emu.waitForKey ? "  [waiting for key]" : "", emu.halted ? "  [halted]" : "");
+    out += buf;
+    for (int r = 0; r < 16; ++r) {
+        std::snprintf(buf, sizeof(buf), "V%X=%02X%s", r, emu.vReg[r], r == 7 ? "\n" : (r == 15 ? "" : " "));
+        out += buf;
+    }
+    if (emu.sp >= 0) {
+        out += "\nstack:";
+        for (int i = emu.sp; i >= 0; --i) {
+            std::snprintf(buf, sizeof(buf), " %03X", emu.stack[i]);
+            out += buf;
+        }
+    }
+    return out;
+}
@@ -0,0 +1,98 @@
+//
+//  Debugger.hpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef Debugger_hpp
+#define Debugger_hpp
+
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Emulator;
+
+// Breakpoints, watchpoints and conditions on top of an Emulator.
+//
+// The debugger drives the emulator itself, through the instrumented
+// instantiation of its execute loop; Emulator::runFrame()/cpuCycle() never
+// look at it. With nothing set, run() falls back to the plain loop.
+//
+// Watchpoints are per-address bitmaps checked against the range an
+// instruction is about to touch (Dxyn/Fx65 read, Fx33/Fx55 write), so the
+// emulator stops *before* the access. Conditions stop when they become true.
+class Debugger
+{
+public:
+    enum class Stop {
+        None,        // budget used up
+        Step,        // step/stepOver/stepOut reached its target
+        Breakpoint,
+        ReadWatch,
+        WriteWatch,
+        Condition,
+        KeyWait,     // Fx0A is waiting and no key is queued
+        Halted       // invalid opcode or stack fault
+    };
+
+    struct Condition {
+        enum Source { Register, IndexRegister, Memory, ProgramCounter, DelayTimer, SoundTimer } source;
+        uint16_t index;   // register number or memory address
+        enum Compare { EQ, NE, LT, LE, GT, GE } compare;
+        uint16_t value;
+    };
+
+    // "V3 == 0x10", "I >= 0x300", "[0x3F0] != 0", "PC == 0x2A4", "DT == 0"
+    static bool parseCondition(const std::string&, Condition&);
+    static std::string describe(const Condition&);
+    // what the condition looks at, and whether it holds, in the emulator's current state.
+    static uint16_t valueOf(const Emulator&, const Condition&);
+    static bool holds(const Emulator&, const Condition&);
+    static const char *stopName(Stop);
+
+    void setBreakpoint(uint16_t address, bool on = true) { breakpoints[address & 0xFFF] = on; }
+    bool hasBreakpoint(uint16_t address) const { return breakpoints[address & 0xFFF]; }
+    void setWatch(uint16_t address, uint16_t length, bool read, bool write, bool on = true);
+    void addCondition(const Condition&);
+    void clearConditions() { conditions.clear(); conditionState.clear(); }
+    void clearAll();
+
+    const std::bitset<0x1000> &getBreakpoints() const { return breakpoints; }
+    const std::vector<Condition> &getConditions() const { return conditions; }
+
+    // the steps always execute the instruction at pc, even if it has a breakpoint
+    // or watchpoint. run() and runFrame() check it too, unless they are resuming
+    // from the last stop at that same pc.
+    Stop step(Emulator&);
+    Stop stepOver(Emulator&, uint64_t maxInstructions);
+    Stop stepOut(Emulator&, uint64_t maxInstructions);
+    Stop run(Emulator&, uint64_t maxInstructions);
+    // one frame's worth of instructions (or of the cycleModel's cycles), then
+    // the frame sink, like Emulator::runFrame(). Waiting for a key is not a
+    // stop here: the frame just has nothing to run.
+    Stop runFrame(Emulator&);
+
+    uint16_t lastStopAddress() const { return stopAddress; }
+
+    // registers, timers, stack and the instruction at pc on a few lines.
+    static std::string describeState(const Emulator&);
+
+private:
+    std::bitset<0x1000> breakpoints, readWatch, writeWatch;
+    std::vector<Condition> conditions;
+    std::vector<bool> conditionState;
+    uint16_t stopAddress = 0;
+    int resumeAt = -1;      // pc of the last stop; -1 after running out of budget
+
+    bool anythingSet() const;
+    Stop checkBefore(const Emulator&);
+    Stop stopped(const Emulator&, Stop);
+    bool conditionHit(const Emulator&);
+    void primeConditions(const Emulator&);
+    template <typename Done> Stop runUntil(Emulator&, uint64_t maxInstructions, bool checkFirst, const Done &done);
+};
+
+#endif /* Debugger_hpp */
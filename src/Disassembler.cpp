@@ -0,0 +1,97 @@
+//
+//  Disassembler.cpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include "Disassembler.hpp"
+
+#include <cstdio>
+
+std::string disassemble(uint16_t opcode)
+{
+    unsigned nnn = opcode & 0xFFF, n = opcode & 0xF, x = (opcode >> 8) & 0xF, y = (opcode >> 4) & 0xF, kk = opcode & 0xFF;
+    char buf[32];
+    switch (opcode >> 12) {
+        case 0x0:
+            if (opcode == 0x00E0)
+                return "CLS";
+            if (opcode == 0x00EE)
+                return "RET";
+            std::snprintf(buf, sizeof(buf), "SYS 0x%03X", nnn);
+            break;
+        case 0x1: std::snprintf(buf, sizeof(buf), "JP 0x%03X", nnn); break;
+        case 0x2: std::snprintf(buf, sizeof(buf), "CALL 0x%03X", nnn); break;
+        case 0x3: std::snprintf(buf, sizeof(buf), "SE V%X, 0x%02X", x, kk); break;
+        case 0x4: std::snprintf(buf, sizeof(buf), "SNE V%X, 0x%02X", x, kk); break;
+        case 0x5: std::snprintf(buf, sizeof(buf), "SE V%X, V%X", x, y); break;
+        case 0x6: std::snprintf(buf, sizeof(buf), "LD V%X, 0x%02X", x, kk); break;
+        case 0x7: std::snprintf(buf, sizeof(buf), "ADD V%X, 0x%02X", x, kk); break;
+        case 0x8: {
+            static const char *ops[16] = { "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+                                           nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, "SHL", nullptr };
+            if (!ops[n])
+                std::snprintf(buf, sizeof(buf), "??? 0x%04X", opcode);
+            else if (n == 0x6 || n == 0xE)
+                std::snprintf(buf, sizeof(buf), "%s V%X", ops[n], x);
+            else
+                std::snprintf(buf, sizeof(buf), "%s V%X, V%X", ops[n], x, y);
+            break;
+        }
+        case 0x9: std::snprintf(buf, sizeof(buf), "SNE V%X, V%X", x, y); break;
+        case 0xA: std::snprintf(buf, sizeof(buf), "LD I, 0x%03X", nnn); break;
+        case 0xB: std::snprintf(buf, sizeof(buf), "JP V0, 0x%03X", nnn); break;
+        case 0xC: std::snprintf(buf, sizeof(buf), "RND V%X, 0x%02X", x, kk); break;
+        case 0xD: std::snprintf(buf, sizeof(buf), "DRW V%X, V%X, %u", x, y, n); break;
+        case 0xE:
+            // the interpreter treats every Ex?? other than Ex9E as ExA1.
+            std::snprintf(buf, sizeof(buf), kk == 0x9E ? "SKP V%X" : "SKNP V%X", x);
+            break;
+        case 0xF:
+            switch (kk) {
+                case 0x07: std::snprintf(buf, sizeof(buf), "LD V%X, DT", x); break;
+                case 0x0A: std::snprintf(buf, sizeof(buf), "LD V%X, K", x); break;
+                case 0x15: std::snprintf(buf, sizeof(buf), "LD DT, V%X", x); break;
+                case 0x18: std::snprintf(buf, sizeof(buf), "LD ST, V%X", x); break;
+                case 0x1E: std::snprintf(buf, sizeof(buf), "ADD I, V%X", x); break;
+                case 0x29: std::snprintf(buf, sizeof(buf), "LD F, V%X", x); break;
+                case 0x33: std::snprintf(buf, sizeof(buf), "LD B, V%X", x); break;
+                case 0x55: std::snprintf(buf, sizeof(buf), "LD [I], V%X", x); break;
+                case 0x65: std::snprintf(buf, sizeof(buf), "LD V%X, [I]", x); break;
+                default: std::snprintf(buf, sizeof(buf), "??? 0x%04X", opcode); break;
+            }
+            break;
+    }
+    return buf;
+}
+
+bool isValidOpcode(uint16_t opcode)
+{
+    unsigned n = opcode & 0xF, kk = opcode & 0xFF;
+    switch (opcode >> 12) {
+        case 0x8:
+            return n <= 0x7 || n == 0xE;
+        case 0xF:
+            return kk == 0x07 || kk == 0x0A || kk == 0x15 || kk == 0x18 || kk == 0x1E || kk == 0x29
+                || kk == 0x33 || kk == 0x55 || kk == 0x65;
+        default:
+            return true;
+    }
+}
+
+bool opcodeWritesVx(uint16_t opcode)
+{
+    switch (opcode >> 12) {
+        case 0x6: case 0x7: case 0xC:
+            return true;
+        case 0x8:
+            return isValidOpcode(opcode);
+        case 0xF: {
+            unsigned kk = opcode & 0xFF;
+            return kk == 0x07 || kk == 0x0A || kk == 0x65;
+        }
+        default:
+            return false;
+    }
+}
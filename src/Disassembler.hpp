@@ -0,0 +1,24 @@
+//
+//  Disassembler.hpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef Disassembler_hpp
+#define Disassembler_hpp
+
+#include <cstdint>
+#include <string>
+
+// Cowgod-style mnemonics, e.g. "LD V3, 0x1F" or "DRW V0, V1, 5".
+// Opcodes the interpreter does not implement come back as "??? 0xNNNN".
+std::string disassemble(uint16_t opcode);
+
+// whether Emulator implements the opcode (anything else halts it).
+bool isValidOpcode(uint16_t opcode);
+
+// whether the opcode writes Vx (VF side effects aside).
+bool opcodeWritesVx(uint16_t opcode);
+
+#endif /* Disassembler_hpp */
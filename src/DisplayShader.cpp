@@ -0,0 +1,78 @@
+//
+//  DisplayShader.cpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include "DisplayShader.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include "DisplayShaderSource.hpp"
+#include "Emulator.hpp"
+
+using namespace ci;
+
+namespace {
+
+gl::Texture2dRef createTexture(int width, int height)
+{
+    auto format = gl::Texture2d::Format().internalFormat(GL_R8).minFilter(GL_NEAREST).magFilter(GL_NEAREST);
+    std::vector<uint8_t> zeros((size_t)width * height);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    return gl::Texture2d::create(zeros.data(), GL_RED, width, height, format);
+}
+
+} // namespace
+
+DisplayShader::DisplayShader()
+{
+    program = gl::GlslProg::create(
+        gl::GlslProg::Format().vertex(shaders::vertexSource).fragment(shaders::fragmentSource));
+    packedTexture = createTexture(displayWidth / 8, displayHeight);
+    levelTexture = createTexture(displayWidth, displayHeight);
+}
+
+void DisplayShader::update(const Emulator &emulator)
+{
+    uint8_t bytes[displayHeight * displayWidth / 8];
+    emulator.packDisplay(bytes);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    packedTexture->update(bytes, GL_RED, GL_UNSIGNED_BYTE, 0, displayWidth / 8, displayHeight);
+    packed = true;
+}
+
+void DisplayShader::update(const uint8_t *levels)
+{
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    levelTexture->update(levels, GL_RED, GL_UNSIGNED_BYTE, 0, displayWidth, displayHeight);
+    packed = false;
+}
+
+void DisplayShader::draw(const Rectf &bounds) const
+{
+    gl::ScopedGlslProg scopedProgram(program);
+    gl::ScopedTextureBind scopedTexture(packed ? packedTexture : levelTexture, 0);
+    program->uniform("uDisplay", 0);
+    program->uniform("uPacked", packed ? 1 : 0);
+    program->uniform("uOff", vec3(offColor.r, offColor.g, offColor.b));
+    program->uniform("uOn", vec3(onColor.r, onColor.g, onColor.b));
+    program->uniform("uScale", bounds.getHeight() / displayHeight);
+    program->uniform("uScanlines", scanlines);
+    // texture coordinates with y down, matching the rows as uploaded.
+    gl::drawSolidRect(bounds, vec2(0, 0), vec2(1, 1));
+}
+
+Rectf DisplayShader::integerFit(const Area &window)
+{
+    int scale = std::min(window.getWidth() / displayWidth, window.getHeight() / displayHeight);
+    Rectf display(0, 0, displayWidth, displayHeight);
+    if (scale < 1)
+        return display.getCenteredFit(Rectf(window), true);
+    // whole-pixel offsets too, or every CHIP-8 pixel would straddle a window pixel.
+    int width = displayWidth * scale, height = displayHeight * scale;
+    int x = window.x1 + (window.getWidth() - width) / 2, y = window.y1 + (window.getHeight() - height) / 2;
+    return Rectf(x, y, x + width, y + height);
+}
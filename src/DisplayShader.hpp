@@ -0,0 +1,55 @@
+//
+//  DisplayShader.hpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef DisplayShader_hpp
+#define DisplayShader_hpp
+
+#include <cstdint>
+
+#include "cinder/gl/gl.h"
+
+class Emulator;
+
+// Draws the display with a fragment shader instead of a CPU-expanded texture.
+//
+// The plain display goes up as it is packed, one bit per pixel: an 8x32
+// single-channel texture, 256 bytes per change. Shaded frames (Phosphor)
+// go up as 64x32 bytes. The shader picks out each pixel's bit or level,
+// maps it through a two-colour palette and darkens scanlines, so the CPU does
+// no per-pixel work and no RGB is uploaded. Only core GLSL 1.50 is used
+// (texelFetch and integer ops), which software rasterizers such as Mesa's
+// llvmpipe run too.
+//
+// The constructor throws if the shader does not compile; callers can fall
+// back to drawing a texture themselves.
+class DisplayShader
+{
+public:
+    DisplayShader();
+
+    void update(const Emulator&);       // the display as it is, packed
+    void update(const uint8_t *levels); // [displayHeight][displayWidth] 0..255, e.g. Phosphor::pixels()
+    void draw(const ci::Rectf &bounds) const;
+
+    // the largest whole multiple of the display that fits, centred; smaller
+    // windows get a plain aspect fit.
+    static ci::Rectf integerFit(const ci::Area &window);
+
+    void setColors(const ci::Color &off, const ci::Color &on) { offColor = off; onColor = on; }
+    // 0: none .. 1: black gap under every pixel row (drawn from 3x scale up).
+    void setScanlines(float strength) { scanlines = strength; }
+    float getScanlines() const { return scanlines; }
+
+private:
+    ci::gl::GlslProgRef program;
+    ci::gl::Texture2dRef packedTexture, levelTexture;
+    bool packed = true;     // which of the two the last update filled
+    ci::Color offColor = ci::Color(0, 0, 0), onColor = ci::Color(1, 1, 1);
+    float scanlines = 0;
+};
+
+#endif /* DisplayShader_hpp */
@@ -0,0 +1,65 @@
+//
+//  DisplayShaderSource.hpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef DisplayShaderSource_hpp
+#define DisplayShaderSource_hpp
+
+// The GLSL behind DisplayShader, apart from Cinder so that
+// tools/ChippyShaderCheck.cpp can run the same program under plain EGL.
+// The vertex stage takes Cinder's ciPosition, ciTexCoord0 (0, 0 top left)
+// and ciModelViewProjection.
+namespace shaders {
+
+const char vertexSource[] = R"(#version 150
+uniform mat4 ciModelViewProjection;
+in vec4 ciPosition;
+in vec2 ciTexCoord0;
+out vec2 vPixel;
+
+void main()
+{
+    vPixel = ciTexCoord0 * vec2(64.0, 32.0);
+    gl_Position = ciModelViewProjection * ciPosition;
+}
+)";
+
+// vPixel runs over the display in CHIP-8 pixels, (0, 0) top left.
+const char fragmentSource[] = R"(#version 150
+uniform sampler2D uDisplay;
+uniform int uPacked;        // 1: 8x32 bytes, MSB leftmost; 0: 64x32 levels
+uniform vec3 uOff;
+uniform vec3 uOn;
+uniform float uScale;       // window pixels per CHIP-8 pixel
+uniform float uScanlines;
+in vec2 vPixel;
+out vec4 oColor;
+
+void main()
+{
+    ivec2 cell = clamp(ivec2(vPixel), ivec2(0), ivec2(63, 31));
+    float level;
+    if (uPacked != 0) {
+        int bits = int(texelFetch(uDisplay, ivec2(cell.x >> 3, cell.y), 0).r * 255.0 + 0.5);
+        level = float((bits >> (7 - (cell.x & 7))) & 1);
+    }
+    else
+        level = texelFetch(uDisplay, cell, 0).r;
+    vec3 color = mix(uOff, uOn, level);
+
+    // the last quarter (at least one row) of each pixel row's height.
+    if (uScanlines > 0.0 && uScale >= 3.0) {
+        float row = fract(vPixel.y) * uScale;
+        if (row >= uScale - max(1.0, floor(uScale / 4.0)))
+            color *= 1.0 - uScanlines;
+    }
+    oColor = vec4(color, 1.0);
+}
+)";
+
+} // namespace shaders
+
+#endif /* DisplayShaderSource_hpp */
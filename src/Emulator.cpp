@@ -6,31 +6,51 @@
 //  Copyright © 2016 bonsu. All rights reserved.
 //
 
+#include <algorithm>
 #include <bitset>
 #include <cassert>
+#include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <initializer_list>
 #include <fstream>
 #include <limits>
 #include <random>
+#include <vector>
 
+#include "CycleModel.hpp"
 #include "DebugUtils.h"
 #include "Emulator.hpp"
+#include "Trace.hpp"
 
-std::random_device rd;
-std::mt19937 rndGenerator(rd());
+// packs eight 0/1 pixel bytes into one byte, first pixel in the MSB.
+// the multiply gathers bit 0 of every byte into the top byte (little-endian hosts).
+static inline uint8_t packEightPixels(const uint8_t *pixels)
+{
+    uint64_t v;
+    std::memcpy(&v, pixels, sizeof(v));
+    return (uint8_t)(((v & 0x0101010101010101ULL) * 0x8040201008040201ULL) >> 56);
+}
 
 Emulator::Emulator()
 {
+    std::random_device rd;
+    rndGenerator.seed(rd());
     initialize();
 }
 
 Emulator::~Emulator() {}
 
-void Emulator::initialize(bool reset)
+// font in the first page, zeros everywhere else. Built once and shared by every
+// instance; nobody writes to it, writableMemory() always copies first.
+const std::shared_ptr<Emulator::MemoryMap> &Emulator::blankMemory()
 {
-    if (!reset) {
-        auto *p = memory;
+    static const std::shared_ptr<MemoryMap> blank = [] {
+        std::shared_ptr<MemoryMap> map = std::make_shared<MemoryMap>();
+        std::shared_ptr<MemoryPage> zero = std::make_shared<MemoryPage>();
+        std::memset(zero->bytes, 0, pageSize);
+        std::shared_ptr<MemoryPage> font = std::make_shared<MemoryPage>(*zero);
+        auto *p = font->bytes;
         for (uint32_t f : { 0xF999F, 0x26227, 0xF1F8F, 0xF1F1F, 0x99F11, 0xF8F1F, 0xF8F9F, 0xF1244,
                             0xF9F9F, 0xF9F1F, 0xF9F99, 0xE9E9E, 0xF888F, 0xE999E, 0xF8F8F, 0xF8F88 }) {
            for (int i = 5; i > 0; --i) {
@@ -38,11 +58,22 @@ void Emulator::initialize(bool reset)
                *(p++) = b;
            }
         }
-    }
+        map->pages[0] = font;
+        for (int i = 1; i < pageCount; ++i)
+            map->pages[i] = zero;
+        return map;
+    }();
+    return blank;
+}
+
+void Emulator::initialize()
+{
+    // font and cleared memory, without touching a byte.
+    memoryMap = blankMemory();
+    for (int i = 0; i < pageCount; ++i)
+        pagePtr[i] = memoryMap->pages[i]->bytes;
+    codePageBase = 0xFFFF;
     
-    // clear memory
-    for (int i = 0 + 0x50; i < 0x1000; ++i)
-        memory[i] = 0;
     for (int i = 0; i < 16; ++i)
         vReg[i] = keys[i] = stack[i] = 0;
     
@@ -52,24 +83,101 @@ void Emulator::initialize(bool reset)
    
     // clear states
     waitForKey = false;
+    waitKeyReg = 0;
+    halted = false;
+    haltOpcode = 0;
+    
+    // drop input meant for the previous run.
+    inputHead = inputTail = 0;
+    std::memset(keyPressedAt, 0, sizeof(keyPressedAt));
+    unshownInputTimestamp = shownInputTimestamp = 0;
     
     
     statInstructionCount = 0;
+    statTotalInstructions = 0;
+    statTotalCycles = 0;
+    statTotalFrames = 0;
+    frameStartInstruction = frameStartCycle = 0;
+    cycleCarry = 0;
     
     // clear the display
-    for (int i = 0; i < 32; ++i)
-        for (int j = 0; j < 64; ++j)
-            display[i][j] = 0;
+    std::memset(display, 0, sizeof(display));
     drawDisplay = true;
     
     pc = 0x200;
+    
+    rebuildFusion();
 }
 
 
 void Emulator::reset()
 {
     DBG_PRINT("resetting...");
-    initialize(true);
+    initialize();
+}
+
+void Emulator::cloneFrom(const Emulator &source)
+{
+    memoryMap = source.memoryMap;
+    std::memcpy(pagePtr, source.pagePtr, sizeof(pagePtr));
+    codePageBase = 0xFFFF;
+    // fusion stays as configured here; the table can only be shared if both use it.
+    if (fused && source.fused)
+        fused = source.fused;
+    else if (fused)
+        rebuildFusion();
+    
+    std::memcpy(display, source.display, sizeof(display));
+    std::memcpy(vReg, source.vReg, sizeof(vReg));
+    std::memcpy(keys, source.keys, sizeof(keys));
+    std::memcpy(stack, source.stack, sizeof(stack));
+    delayTimer = source.delayTimer;
+    soundTimer = source.soundTimer;
+    pc = source.pc;
+    I = source.I;
+    sp = source.sp;
+    waitForKey = source.waitForKey;
+    waitKeyReg = source.waitKeyReg;
+    halted = source.halted;
+    haltOpcode = source.haltOpcode;
+    rndGenerator = source.rndGenerator;
+    statTotalInstructions = source.statTotalInstructions;
+    statTotalCycles = source.statTotalCycles;
+    statTotalFrames = source.statTotalFrames;
+    frameStartInstruction = source.frameStartInstruction;
+    frameStartCycle = source.frameStartCycle;
+    cycleCarry = source.cycleCarry;
+    std::memcpy(keyPressedAt, source.keyPressedAt, sizeof(keyPressedAt));
+    // the fork starts with no input of its own queued.
+    inputHead = inputTail = 0;
+    unshownInputTimestamp = shownInputTimestamp = 0;
+    drawDisplay = true;
+    // currentProgram is left alone: copying a path would be the one allocation here.
+}
+
+uint8_t *Emulator::writableMemory(const uint16_t address)
+{
+    const int p = address >> pageBits;
+    if (memoryMap.use_count() != 1)
+        memoryMap = std::make_shared<MemoryMap>(*memoryMap);
+    auto &page = memoryMap->pages[p];
+    if (page.use_count() != 1) {
+        page = std::make_shared<MemoryPage>(*page);
+        pagePtr[p] = page->bytes;
+        codePageBase = 0xFFFF;
+    }
+    return &pagePtr[p][address & (pageSize - 1)];
+}
+
+void Emulator::writeMemory(uint16_t address, const uint8_t *data, size_t size)
+{
+    while (size) {
+        size_t chunk = std::min<size_t>(size, pageSize - (address & (pageSize - 1)));
+        std::memcpy(writableMemory(address), data, chunk);
+        address = (address + chunk) & 0xFFF;
+        data += chunk;
+        size -= chunk;
+    }
 }
 
 bool Emulator::loadBinary(const std::string& progName)
@@ -82,7 +190,10 @@ bool Emulator::loadBinary(const std::string& progName)
             return false;
         }
         file.seekg(0, std::ios::beg);
-        file.read((char*)(memory+0x200), size); // Eurgh, replace with constants.
+        std::vector<uint8_t> rom((size_t)size);
+        file.read((char*)rom.data(), size);
+        writeMemory(0x200, rom.data(), rom.size()); // Eurgh, replace with constants.
+        rebuildFusion();
     }
     else {
         // failed to open file.
@@ -94,20 +205,267 @@ bool Emulator::loadBinary(const std::string& progName)
     return true;
 }
 
+bool Emulator::loadBinary(const uint8_t *data, size_t size)
+{
+    if (size > (0x1000-0x200))
+        return false;
+    writeMemory(0x200, data, size);
+    rebuildFusion();
+    currentProgram = "";
+    return true;
+}
+
+void Emulator::saveState(State& s) const
+{
+    for (int i = 0; i < pageCount; ++i)
+        std::memcpy(s.memory + i * pageSize, pagePtr[i], pageSize);
+    std::memcpy(s.display, display, sizeof(display));
+    std::memcpy(s.vReg, vReg, sizeof(vReg));
+    std::memcpy(s.keys, keys, sizeof(keys));
+    std::memcpy(s.stack, stack, sizeof(stack));
+    s.delayTimer = delayTimer;
+    s.soundTimer = soundTimer;
+    s.pc = pc;
+    s.I = I;
+    s.sp = sp;
+    s.waitForKey = waitForKey;
+    s.waitKeyReg = waitKeyReg;
+    s.halted = halted;
+    s.haltOpcode = haltOpcode;
+    s.cycleCarry = cycleCarry;
+    s.rndGenerator = rndGenerator;
+}
+
+void Emulator::loadState(const State& s)
+{
+    writeMemory(0, s.memory, sizeof(s.memory));
+    std::memcpy(display, s.display, sizeof(display));
+    std::memcpy(vReg, s.vReg, sizeof(vReg));
+    std::memcpy(keys, s.keys, sizeof(keys));
+    std::memcpy(stack, s.stack, sizeof(stack));
+    delayTimer = s.delayTimer;
+    soundTimer = s.soundTimer;
+    pc = s.pc;
+    I = s.I;
+    sp = s.sp;
+    waitForKey = s.waitForKey;
+    waitKeyReg = s.waitKeyReg;
+    halted = s.halted;
+    haltOpcode = s.haltOpcode;
+    cycleCarry = s.cycleCarry;
+    rndGenerator = s.rndGenerator;
+    // keys held in the restored state may be released straight away.
+    std::memset(keyPressedAt, 0, sizeof(keyPressedAt));
+    drawDisplay = true;
+    rebuildFusion();
+}
+
+bool Emulator::isValidState(const State& s)
+{
+    // the flags are read as bytes: any other value in a bool is undefined.
+    uint8_t waiting, halt;
+    std::memcpy(&waiting, &s.waitForKey, 1);
+    std::memcpy(&halt, &s.halted, 1);
+    if (waiting > 1 || halt > 1)
+        return false;
+    if (s.sp < -1 || s.sp > 15 || s.pc > 0xFFF || s.I > 0xFFF || s.waitKeyReg > 0xF)
+        return false;
+    for (uint16_t address : s.stack)
+        if (address > 0xFFF)
+            return false;
+    // runCycles() leaves at most one instruction's cost, always negative; far
+    // more than any frame budget would only overflow the next one.
+    return s.cycleCarry <= 0 && s.cycleCarry >= -(1 << 16);
+}
+
 void Emulator::setKeyPressed(const uint8_t key)
 {
-    keys[key] = 1;
+    keyChanged(key & 0xF, true);
+}
+
+void Emulator::setKeyReleased(const uint8_t key)
+{
+    keyChanged(key & 0xF, false);
+}
+
+void Emulator::keyChanged(const uint8_t key, const bool down)
+{
+    const bool wasDown = keys[key] != 0;
+    keys[key] = down;
+    // pressed after the frame's first instruction: it is down for all of the next one.
+    if (down)
+        keyPressedAt[key] = statTotalFrames + (statTotalInstructions != frameStartInstruction);
     
-    if (waitForKey) {
-        vReg[op_x] = key;
+    // Fx0A completes on the press, or with the quirk on the release of a key
+    // that was actually down.
+    if (waitForKey && (keyWaitOnRelease ? !down && wasDown : down)) {
+        vReg[waitKeyReg] = key;
         waitForKey = false;
     }
+}
 
+void Emulator::pushKeyEvent(const uint8_t key, const bool down, const uint64_t timestampNs, const uint64_t atInstruction)
+{
+    // full: the oldest event goes in now rather than being lost.
+    if (inputTail - inputHead == inputQueueSize)
+        applyInput(true);
+    InputEvent &e = inputQueue[inputTail % inputQueueSize];
+    e.atInstruction = atInstruction;
+    e.timestampNs = timestampNs;
+    e.key = key & 0xF;
+    e.down = down;
+    ++inputTail;
 }
 
-void Emulator::setKeyReleased(const uint8_t key)
+// applies queued events that are due, in order; with force, just the oldest.
+void Emulator::applyInput(const bool force)
+{
+    while (inputHead != inputTail) {
+        const InputEvent &e = inputQueue[inputHead % inputQueueSize];
+        // nothing runs while Fx0A waits, so the machine looks the same at every
+        // later instruction number; applying early is what lets it wake.
+        if (!force && !waitForKey) {
+            if (e.atInstruction > statTotalInstructions)
+                break;
+            // a tap must be seen for a while; later events wait behind it to stay in order.
+            if (!e.down && keys[e.key] && statTotalFrames < keyPressedAt[e.key] + (uint64_t)minKeyHoldFrames)
+                break;
+        }
+        if (e.timestampNs && !unshownInputTimestamp)
+            unshownInputTimestamp = e.timestampNs;
+        keyChanged(e.key, e.down);
+        ++inputHead;
+        if (force)
+            return;
+    }
+}
+
+uint64_t Emulator::takeShownInputTimestamp()
+{
+    uint64_t t = shownInputTimestamp;
+    shownInputTimestamp = 0;
+    return t;
+}
+
+void Emulator::inputShown()
+{
+    if (!shownInputTimestamp)
+        shownInputTimestamp = unshownInputTimestamp;
+    unshownInputTimestamp = 0;
+}
+
+uint64_t Emulator::timestampNow()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Emulator::setKeyMask(const uint16_t mask)
+{
+    for (uint8_t key = 0; key < 16; ++key) {
+        bool down = (mask >> key) & 1;
+        if (down && !keys[key])
+            setKeyPressed(key);
+        else if (!down && keys[key])
+            setKeyReleased(key);
+    }
+}
+
+uint16_t Emulator::getKeyMask() const
+{
+    uint16_t mask = 0;
+    for (int key = 0; key < 16; ++key)
+        if (keys[key])
+            mask |= 1 << key;
+    return mask;
+}
+
+void Emulator::seedRandom(const uint32_t seed)
+{
+    rndGenerator.seed(seed);
+}
+
+void Emulator::packDisplay(uint64_t rows[displayHeight]) const
+{
+    for (int y = 0; y < displayHeight; ++y) {
+        uint64_t row = 0;
+        for (int b = 0; b < displayWidth / 8; ++b)
+            row = (row << 8) | packEightPixels(&display[y][b * 8]);
+        rows[y] = row;
+    }
+}
+
+void Emulator::packDisplay(uint8_t bytes[displayHeight * displayWidth / 8]) const
+{
+    for (int y = 0; y < displayHeight; ++y) {
+        for (int b = 0; b < displayWidth / 8; ++b)
+            *(bytes++) = packEightPixels(&display[y][b * 8]);
+    }
+}
+
+uint64_t Emulator::displayHash() const
+{
+    // FNV-1a over the packed rows, stable across hosts so it can be stored as a golden value.
+    uint64_t rows[displayHeight];
+    packDisplay(rows);
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (uint64_t row : rows) {
+        for (int i = 0; i < 8; ++i) {
+            h ^= (row >> (i * 8)) & 0xFF;
+            h *= 0x100000001b3ULL;
+        }
+    }
+    return h;
+}
+
+uint64_t Emulator::stateHash() const
 {
-    keys[key] = 0;
+    // a word at a time; unlike displayHash() this is never stored, only compared within a run.
+    auto mixInto = [](uint64_t &h, uint64_t w) {
+        h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    };
+    // memory and display in four independent lanes, so the multiplies overlap instead of chaining.
+    uint64_t lane[4] = { 0x84222325cbf29ce4ULL, 1, 2, 3 };
+    auto mixBlock = [&](const uint8_t *bytes, size_t size) {
+        for (size_t i = 0; i < size; i += 32) {
+            uint64_t w[4];
+            std::memcpy(w, bytes + i, 32);
+            mixInto(lane[0], w[0]);
+            mixInto(lane[1], w[1]);
+            mixInto(lane[2], w[2]);
+            mixInto(lane[3], w[3]);
+        }
+    };
+    for (int p = 0; p < pageCount; ++p)
+        mixBlock(pagePtr[p], pageSize);
+    mixBlock(&display[0][0], sizeof(display));
+    uint64_t h = lane[0];
+    auto mix = [&](uint64_t w) { mixInto(h, w); };
+    mix(lane[1]);
+    mix(lane[2]);
+    mix(lane[3]);
+    
+    uint8_t regs[16 + 16 + sizeof(stack) + 8];
+    std::memcpy(regs, vReg, 16);
+    std::memcpy(regs + 16, keys, 16);
+    std::memcpy(regs + 32, stack, sizeof(stack));
+    uint8_t *r = regs + 32 + sizeof(stack);
+    r[0] = pc & 0xFF; r[1] = (pc >> 8) | (waitForKey << 4) | (halted << 5);
+    r[2] = I & 0xFF; r[3] = I >> 8;
+    r[4] = (uint8_t)sp; r[5] = delayTimer; r[6] = soundTimer; r[7] = waitKeyReg;
+    for (size_t i = 0; i < sizeof(regs); i += 8) {
+        uint64_t w;
+        std::memcpy(&w, regs + i, 8);
+        mix(w);
+    }
+    // only under a cycleModel; zero otherwise, and left out so hashes stay as they were.
+    if (cycleCarry)
+        mix((uint32_t)cycleCarry);
+    // the next draw is a one-to-one function of the generator's state.
+    std::minstd_rand next = rndGenerator;
+    mix(next());
+    return h;
 }
 
 bool Emulator::makeSound()
@@ -118,30 +476,301 @@ bool Emulator::makeSound()
     return false;
 }
 
-void Emulator::cpuCycle()
+// one fetch/decode/execute. The Instrumented instantiation is only entered
+// while a TraceBuffer or Debugger is attached, so the plain one carries no
+// tracing or debugging code at all.
+template <bool Instrumented, bool FrameTimers>
+void Emulator::execute()
 {
+    if (inputHead != inputTail)
+        applyInput();
+    
     // encapsulate everything in wait for key check
-    if (!waitForKey) {
+    if (!waitForKey && !halted) {
         // fetch, decode, execute;
-        if (pc < 0x1000) {
-            uint16_t opcode = (memory[pc] << 8) | memory[pc + 1];
+        if (pc < 0xFFF) {
+            uint16_t opcode;
+            if ((pc & ~(pageSize - 1)) == codePageBase && (pc & (pageSize - 1)) != pageSize - 1) {
+                opcode = (codePage[pc & (pageSize - 1)] << 8) | codePage[(pc & (pageSize - 1)) + 1];
+            }
+            else {
+                // new page, or an instruction straddling two.
+                codePageBase = pc & ~(pageSize - 1);
+                codePage = pagePtr[pc >> pageBits];
+                opcode = (readMemory(pc) << 8) | readMemory(pc + 1);
+            }
+            uint16_t opcodePc = pc;
             decodeInstr(opcode);
-            DBG_PRINT_NO_NEWLINE(std::setw(4) << std::setfill('0') << std::hex << opcode << std::setfill(' '));
             // call the right opcode function for opcode.
             (this->*opcodeFuncTable[op_instr])();
             
-            if (delayTimer)
+            if (!FrameTimers && delayTimer)
                 --delayTimer;
             
             // TODO: implement
-            if (soundTimer)
+            if (!FrameTimers && soundTimer)
                 --soundTimer;
             
+            if (Instrumented && tracer) {
+                TraceRecord r;
+                r.cycle = (uint32_t)statTotalInstructions;
+                r.pc = opcodePc;
+                r.opcode = opcode;
+                r.I = I;
+                r.reg = (uint8_t)op_x;
+                r.value = vReg[op_x];
+                r.vf = vReg[VF];
+                r.flags = halted ? traceFlagHalted : 0;
+                r.reserved = 0;
+                tracer->append(statTotalInstructions, r);
+            }
+            
             ++statInstructionCount;
-            DBG_PRINT_NO_NEWLINE("\t\t\t\t");
-            DBG_PRINT_VAR_DEC(pc);
-            //pc += 2;
+            ++statTotalInstructions;
+        }
+    }
+}
+
+template void Emulator::execute<true>();
+template void Emulator::execute<false>();
+template void Emulator::execute<true, true>();
+template void Emulator::execute<false, true>();
+
+void Emulator::cpuCycle()
+{
+    if (tracer)
+        execute<true>();
+    else
+        execute<false>();
+}
+
+void Emulator::runFrame()
+{
+    if (cycleModel)
+        runCycles();
+    else if (tracer)
+        for (int i = 0; i < instructionsPerFrame; ++i)
+            execute<true>();
+    else if (fused)
+        executeFused(instructionsPerFrame);
+    else
+        for (int i = 0; i < instructionsPerFrame; ++i)
+            execute<false>();
+    if (!cycleModel)
+        frameDone();
+    if (frameSink)
+        frameSink->frameComplete(*this);
+}
+
+void Emulator::frameDone()
+{
+    ++statTotalFrames;
+    frameStartInstruction = statTotalInstructions;
+    frameStartCycle = statTotalCycles - std::min<uint64_t>(statTotalCycles, (uint64_t)-cycleCarry);
+}
+
+uint64_t Emulator::frameTime() const
+{
+    return cycleModel ? statTotalCycles - frameStartCycle : statTotalInstructions - frameStartInstruction;
+}
+
+uint64_t Emulator::frameLength() const
+{
+    return (uint64_t)std::max(cycleModel ? cycleModel->frameBudget() : instructionsPerFrame, 1);
+}
+
+// one frame's worth of machine cycles under cycleModel. An instruction that
+// runs past the end of the frame takes the rest from the next one.
+bool Emulator::runCycles(const CycleStep step, void *const context)
+{
+    const CycleModel &model = *cycleModel;
+    int budget = model.frameBudget() + cycleCarry;
+    cycleCarry = 0;
+    bool drawWait = false;
+    while (budget > 0) {
+        if (inputHead != inputTail)
+            applyInput();
+        // nothing would run for the rest of the frame.
+        if (waitForKey || halted || pc >= 0xFFF) {
+            if (cycleProfile)
+                ++cycleProfile->idleFrames;
+            break;
+        }
+        const uint16_t before = pc;
+        const uint16_t opcode = (readMemory(pc) << 8) | readMemory(pc + 1);
+        const uint8_t vx = vReg[(opcode >> 8) & 0xF];
+        if (step) {
+            // stopped: the rest of the frame is dropped and the timers stay,
+            // as Debugger::run() drops the rest of an instruction budget.
+            if (!step(*this, context))
+                return false;
+        }
+        else if (tracer)
+            execute<true, true>();
+        else
+            execute<false, true>();
+        const uint32_t cost = model.cost(opcode, pc == before + 4, vx);
+        statTotalCycles += cost;
+        if (cycleProfile) {
+            CycleModel::Class c = CycleModel::classify(opcode);
+            ++cycleProfile->count[c];
+            cycleProfile->cycles[c] += cost;
+        }
+        if (model.drawWaitsForFrame && (opcode >> 12) == 0xD) {
+            // the interpreter waits for the next frame's interrupt and draws then.
+            cycleCarry = -(int)cost;
+            drawWait = true;
+            break;
+        }
+        budget -= (int)cost;
+    }
+    if (!drawWait && budget < 0)
+        cycleCarry = budget;
+    if (delayTimer)
+        --delayTimer;
+    if (soundTimer)
+        --soundTimer;
+    if (cycleProfile) {
+        ++cycleProfile->frames;
+        cycleProfile->drawWaits += drawWait;
+    }
+    frameDone();
+    return true;
+}
+
+// runs budget instructions like that many execute<false>() calls, taking a fused
+// sequence whenever one starts at pc and fits in what is left of the budget.
+// Skips that land inside a sequence simply find that address's own entry.
+void Emulator::executeFused(int budget)
+{
+    while (budget > 0) {
+        if (inputHead != inputTail)
+            applyInput();
+        // execute<false>() would do nothing for the rest of the frame either.
+        if (waitForKey || halted || pc >= 0xFFF)
+            return;
+        const FusedOp &f = (*fused)[pc];
+        // queued input is due at exact instructions, so step singly until it is in.
+        if (f.kind == FusedOp::None || f.length > budget || inputHead != inputTail) {
+            execute<false>();
+            --budget;
+            continue;
+        }
+        
+        int executed = f.length;
+        switch (f.kind) {
+            case FusedOp::LdIDrw:
+                I = f.nnn;
+                drawSprite(vReg[f.x], vReg[f.y], f.kk);
+                pc += 4;
+                break;
+            case FusedOp::LdLd:
+                vReg[f.x] = f.kk;
+                vReg[f.y] = f.kk2;
+                pc += 4;
+                break;
+            case FusedOp::AddSeJp:
+                vReg[f.x] += f.kk;
+                if (vReg[f.y] == f.kk2) {
+                    pc += 6;    // the skip jumps over the 1nnn, which never runs
+                    executed = 2;
+                }
+                else {
+                    pc = f.nnn;
+                }
+                break;
+            case FusedOp::AddILdMem:
+                I += vReg[f.x];
+                loadRegisters(f.y);
+                pc += 4;
+                break;
+            default:
+                break;
         }
+        
+        // none of the fused instructions touch the timers, so ticking them
+        // down once per sequence is the same as once per instruction.
+        delayTimer = delayTimer > executed ? delayTimer - executed : 0;
+        soundTimer = soundTimer > executed ? soundTimer - executed : 0;
+        statInstructionCount += executed;
+        statTotalInstructions += executed;
+        budget -= executed;
+    }
+}
+
+void Emulator::setFusion(const bool on)
+{
+    if (on) {
+        fused = std::make_shared<std::vector<FusedOp>>(0x1000);
+        rebuildFusion();
+    }
+    else {
+        fused.reset();
+    }
+}
+
+void Emulator::rebuildFusion()
+{
+    if (!fused)
+        return;
+    if (fused.use_count() != 1)
+        fused = std::make_shared<std::vector<FusedOp>>(*fused);
+    for (uint32_t a = 0; a < 0x1000; ++a)
+        analyzeFusion((uint16_t)a);
+}
+
+// Fx33/Fx55 wrote memory: any sequence starting up to 5 bytes earlier may have changed.
+void Emulator::memoryWritten(const uint16_t address, const int length)
+{
+    ++writes;
+    if (!fused)
+        return;
+    if (fused.use_count() != 1)
+        fused = std::make_shared<std::vector<FusedOp>>(*fused);
+    for (int a = address - 5; a < address + length; ++a)
+        analyzeFusion((uint16_t)(a & 0xFFF));
+}
+
+void Emulator::analyzeFusion(const uint16_t address)
+{
+    FusedOp &f = (*fused)[address];
+    f = FusedOp();
+    auto op = [this](uint32_t a) { return (uint16_t)((readMemory(a) << 8) | readMemory(a + 1)); };
+    // every instruction of the sequence must lie below the pc < 0xFFF fetch limit.
+    if (address + 4 > 0x1000)
+        return;
+    uint16_t a = op(address), b = op(address + 2);
+    
+    if ((a >> 12) == 0xA && (b >> 12) == 0xD) {
+        f.kind = FusedOp::LdIDrw;
+        f.length = 2;
+        f.nnn = a & 0xFFF;
+        f.x = (b >> 8) & 0xF;
+        f.y = (b >> 4) & 0xF;
+        f.kk = b & 0xF;
+    }
+    else if ((a >> 12) == 0x6 && (b >> 12) == 0x6) {
+        f.kind = FusedOp::LdLd;
+        f.length = 2;
+        f.x = (a >> 8) & 0xF;
+        f.kk = a & 0xFF;
+        f.y = (b >> 8) & 0xF;
+        f.kk2 = b & 0xFF;
+    }
+    else if ((a >> 12) == 0x7 && (b >> 12) == 0x3 && address + 6 <= 0x1000 && (op(address + 4) >> 12) == 0x1) {
+        f.kind = FusedOp::AddSeJp;
+        f.length = 3;
+        f.x = (a >> 8) & 0xF;
+        f.kk = a & 0xFF;
+        f.y = (b >> 8) & 0xF;
+        f.kk2 = b & 0xFF;
+        f.nnn = op(address + 4) & 0xFFF;
+    }
+    else if ((a & 0xF0FF) == 0xF01E && (b & 0xF0FF) == 0xF065) {
+        f.kind = FusedOp::AddILdMem;
+        f.length = 2;
+        f.x = (a >> 8) & 0xF;
+        f.y = (b >> 8) & 0xF;
     }
 }
 
@@ -199,75 +828,69 @@ void Emulator::opcodeFDispatch()
     else if (op_kk == 0x65)
         this->ldRegMemOpcodeFunc();
     else {
-        DBG_PRINT("opcode decode fail");
-        DBG_PRINT_VAR(op_kk);
-        assert(false);
+        this->invalidOpcodeFunc();
     }
 }
 
+void Emulator::invalidOpcodeFunc()
+{
+    // leave pc on the offending instruction so it can be inspected.
+    halted = true;
+    haltOpcode = (op_instr << 12) | op_nnn;
+}
+
 void Emulator::clsOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
     for (int i = 0; i < 32; ++i)
         for (int j = 0; j < 64; ++j)
             display[i][j] = 0;
+    ++writes;
+    if (unshownInputTimestamp)
+        inputShown();
+    if (displaySink)
+        displaySink->displayChanged(*this);
     pc += 2;
 }
 
 void Emulator::retOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
-    DBG_PRINT_VAR_DEC(sp);
+    if (sp < 0) {
+        invalidOpcodeFunc(); // stack underflow
+        return;
+    }
     pc = stack[sp--];
-    DBG_PRINT_VAR_DEC(pc);
-    DBG_PRINT_VAR_DEC(sp);
-    
 }
 
 void Emulator::sysOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
     pc += 2;
 //    __NOT_IMPLEMENTED_CONTINUE__
 }
 
 void Emulator::jpOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
     pc = op_nnn;
-    DBG_PRINT_VAR_DEC(op_nnn);
-    DBG_PRINT_VAR_DEC(pc);
-    DBG_PRINT_VAR(memory[pc]);
-    DBG_PRINT_VAR(memory[pc+1]);
 }
 
 void Emulator::callOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
-    DBG_PRINT_VAR_DEC(sp);
+    if (sp >= 15) {
+        invalidOpcodeFunc(); // stack overflow
+        return;
+    }
     stack[++sp] = pc + 2; // set return address, bug
-    DBG_PRINT_VAR_DEC(sp);
-    DBG_PRINT_VAR_DEC(stack[sp]);
     pc = op_nnn;
-    DBG_PRINT_VAR_DEC(op_nnn);
-    DBG_PRINT_VAR_DEC(pc);
-    
 }
 
 void Emulator::seByteOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
     if (vReg[op_x] == op_kk)
         pc += 2;
-    DBG_PRINT_VAR(vReg[op_x]);
-    DBG_PRINT_VAR(op_kk);
     pc += 2;
 }
 
 void Emulator::sneByteOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
-    DBG_PRINT_VAR_DEC(pc);
     if (vReg[op_x] != op_kk)
         pc += 2;
     pc += 2;
@@ -275,7 +898,6 @@ void Emulator::sneByteOpcodeFunc()
 
 void Emulator::seRegOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
     if (vReg[op_x] == vReg[op_y])
         pc += 2;
     pc += 2;
@@ -283,52 +905,42 @@ void Emulator::seRegOpcodeFunc()
 
 void Emulator::ldRegByteOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
     vReg[op_x] = op_kk;
     pc += 2;
-    DBG_PRINT_VAR(op_kk);
-    DBG_PRINT_VAR(vReg[op_x]);
-    
 }
 
 void Emulator::addRegByteOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
     vReg[op_x] = vReg[op_x] + op_kk;
     pc += 2;
 }
 
 void Emulator::ldRegRegOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
     vReg[op_x] = vReg[op_y];
     pc += 2;
 }
 
 void Emulator::orOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
     vReg[op_x] = vReg[op_x] | vReg[op_y];
     pc += 2;
 }
 
 void Emulator::andOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
     vReg[op_x] = vReg[op_x] & vReg[op_y];
     pc += 2;
 }
 
 void Emulator::xorOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
     vReg[op_x] = vReg[op_x] ^ vReg[op_y];
     pc += 2;
 }
 
 void Emulator::addRegRegOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
     uint16_t r = vReg[op_x] + vReg[op_y];
     if (r > std::numeric_limits<uint8_t>::max())
         vReg[VF] = 1;
@@ -338,12 +950,10 @@ void Emulator::addRegRegOpcodeFunc()
     vReg[op_x] = r & 0xFF;
     
     pc += 2;
-    
 }
 
 void Emulator::subOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
     if (vReg[op_x] > vReg[op_y])
         vReg[VF] = 1;
     else
@@ -356,22 +966,17 @@ void Emulator::subOpcodeFunc()
 
 void Emulator::shrOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
-    DBG_PRINT_BINARY(vReg[op_x]);
     if (vReg[op_x] & 1)
         vReg[VF] = 1;
     else
         vReg[VF] = 0;
     vReg[op_x] >>= 1;
-    DBG_PRINT_BINARY(vReg[op_x]);
-    DBG_PRINT_VAR(vReg[VF]);
     
     pc += 2;
 }
 
 void Emulator::subnOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
     if (vReg[op_y] > vReg[op_x])
         vReg[VF] = 1;
     else
@@ -384,22 +989,17 @@ void Emulator::subnOpcodeFunc()
 
 void Emulator::shlOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
-    DBG_PRINT_BINARY(vReg[op_x]);
     if ((vReg[op_x] >> 7) & 1)
         vReg[VF] = 1;
     else
         vReg[VF] = 0;
     vReg[op_x] <<= 1;
-    DBG_PRINT_BINARY(vReg[op_x]);
-    DBG_PRINT_VAR(vReg[VF]);
     
     pc += 2;
 }
 
 void Emulator::sneRegRegOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
     if (vReg[op_x] != vReg[op_y])
         pc += 2;
     pc += 2;
@@ -409,60 +1009,52 @@ void Emulator::ldIOpcodeFunc()
 {
     I = op_nnn;
     pc += 2;
-    DBG_PRINT_FUNC;
-    DBG_PRINT_VAR(op_nnn);
-    DBG_PRINT_VAR_DEC(I);
 }
 
 void Emulator::jpV0OpcodeFunc()
 {
     pc = vReg[V0] + op_nnn;
     pc += 2;
-    DBG_PRINT_FUNC;
-    DBG_PRINT_VAR(vReg[V0]);
-    DBG_PRINT_VAR(op_nnn);
-    DBG_PRINT_VAR(pc);
 }
 
 void Emulator::rndOpcodeFunc()
 {
-    std::uniform_int_distribution<> dis(0, 255);
-    auto rndNum = dis(rndGenerator);
+    // take the byte directly rather than via a distribution so seeded runs match on every host.
+    auto rndNum = (rndGenerator() >> 8) & 0xFF;
 
     vReg[op_x] = rndNum & op_kk;
     
     pc += 2;
-    
-    DBG_PRINT_FUNC;
-    DBG_PRINT_VAR(rndNum);
-    DBG_PRINT_VAR(op_kk);
-    DBG_PRINT_VAR(op_x);
-    DBG_PRINT_VAR(vReg[op_x]);
 }
 
 void Emulator::drwOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
+    drawSprite(vReg[op_x], vReg[op_y], op_n);
+    
+    pc += 2;
+}
+
+void Emulator::drawSprite(const uint8_t xPos, const uint8_t yPos, const uint8_t height)
+{
     vReg[VF] = 0;
-    for (int y = 0; y < op_n; ++y) {
-        auto pixel = memory[I + y];
-        //DBG_PRINT_VAR(I);
-        //DBG_PRINT_VAR(y);
-        //DBG_PRINT_VAR(memory[I + y]);
-        DBG_PRINT_PIXEL_DATA(pixel);
+    for (int y = 0; y < height; ++y) {
+        auto pixel = readMemory((I + y) & 0xFFF);
         for (int x = 0; x < 8; ++x) {
             if ((pixel & (0x80 >> x)) != 0) {
-                if (display[y + vReg[op_y]][x + vReg[op_x]] == 1)
+                // sprites wrap around the screen edges.
+                auto &p = display[(y + yPos) % displayHeight][(x + xPos) % displayWidth];
+                if (p == 1)
                     vReg[VF] = 1;
-                display[y + vReg[op_y]][x + vReg[op_x]] ^= 1;
+                p ^= 1;
             }
         }
     }
     drawDisplay = true;
-    
-    pc += 2;
-    
-    DBG_PRINT_VAR(vReg[VF]);
+    ++writes;
+    if (unshownInputTimestamp)
+        inputShown();
+    if (displaySink)
+        displaySink->displayChanged(*this);
 }
 
 void Emulator::skpOpcodeFunc()
@@ -471,9 +1063,6 @@ void Emulator::skpOpcodeFunc()
         pc += 2;
     
     pc += 2;
-    DBG_PRINT_FUNC;
-    DBG_PRINT_VAR(keys[vReg[op_x]]);
-    DBG_PRINT_VAR(pc);
 }
 
 void Emulator::sknpOpcodeFunc()
@@ -482,9 +1071,6 @@ void Emulator::sknpOpcodeFunc()
         pc += 2;
     
     pc += 2;
-    DBG_PRINT_FUNC;
-    DBG_PRINT_VAR(keys[vReg[op_x]]);
-    DBG_PRINT_VAR(pc);
 }
 
 void Emulator::ldRegDelayOpcodeFunc()
@@ -492,26 +1078,20 @@ void Emulator::ldRegDelayOpcodeFunc()
     vReg[op_x] = delayTimer;
     
     pc += 2;
-    DBG_PRINT_FUNC;
-    DBG_PRINT_VAR(delayTimer);
-    DBG_PRINT_VAR(vReg[op_x]);
 }
 
 void Emulator::ldRegKeyOpcodeFunc()
 {
     waitForKey = true;
+    waitKeyReg = (uint8_t)op_x;
     
     pc += 2;
-    DBG_PRINT_FUNC;
 }
 
 void Emulator::ldDelayRegOpcodeFunc()
 {
     delayTimer = vReg[op_x];
     pc += 2;
-    DBG_PRINT_VAR(vReg[op_x]);
-    
-    DBG_PRINT_FUNC;
 }
 
 void Emulator::ldSoundRegOpcodeFunc()
@@ -519,18 +1099,13 @@ void Emulator::ldSoundRegOpcodeFunc()
     soundTimer = vReg[op_x];
    
     pc += 2;
-    DBG_PRINT_FUNC;
 }
 
 void Emulator::addIRegOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
-    DBG_PRINT_VAR_DEC(I);
     I += vReg[op_x];
 
     pc += 2;
-    DBG_PRINT_VAR_DEC(vReg[op_x]);
-    DBG_PRINT_VAR_DEC(I);
 }
 
 void Emulator::ldFRegOpcodeFunc()
@@ -539,45 +1114,36 @@ void Emulator::ldFRegOpcodeFunc()
     I = fontLocation;
     
     pc += 2;
-    DBG_PRINT_FUNC;
-    DBG_PRINT_VAR(vReg[op_x]);
-    DBG_PRINT_VAR(fontLocation);
-    DBG_PRINT_VAR(I);
 }
 
 void Emulator::ldBRegOpcodeFunc()
 {
-    memory[I] = vReg[op_x] / 100;
-    memory[I + 1] = (vReg[op_x] / 10) % 10;
-    memory[I + 2] = vReg[op_x] % 10;
+    *writableMemory(I & 0xFFF) = vReg[op_x] / 100;
+    *writableMemory((I + 1) & 0xFFF) = (vReg[op_x] / 10) % 10;
+    *writableMemory((I + 2) & 0xFFF) = vReg[op_x] % 10;
+    memoryWritten(I, 3);
 
     pc += 2;
-    DBG_PRINT_FUNC;
-    DBG_PRINT_VAR_DEC(vReg[op_x]);
-    DBG_PRINT_VAR_DEC(memory[I]);
-    DBG_PRINT_VAR_DEC(memory[I + 1]);
-    DBG_PRINT_VAR_DEC(memory[I + 2]);
 }
 
 void Emulator::ldMemRegOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
-    DBG_PRINT_REG;
     for (int i = 0; i <= op_x; ++i) {
-        memory[I + i] = vReg[i];
-        DBG_PRINT_VAR(memory[I + i]);
+        *writableMemory((I + i) & 0xFFF) = vReg[i];
     }
+    memoryWritten(I, op_x + 1);
     pc += 2;
 }
 
 void Emulator::ldRegMemOpcodeFunc()
 {
-    DBG_PRINT_FUNC;
-    DBG_PRINT_VAR_DEC(I);
-    for (int i = 0; i <= op_x; ++i) {
-        vReg[i] = memory[I + i];
-        DBG_PRINT_VAR(memory[I + i]);
-    }
-    DBG_PRINT_REG;
+    loadRegisters(op_x);
     pc += 2;
+}
+
+void Emulator::loadRegisters(const uint8_t last)
+{
+    for (int i = 0; i <= last; ++i) {
+        vReg[i] = readMemory((I + i) & 0xFFF);
+    }
 }
\ No newline at end of file
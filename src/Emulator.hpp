@@ -10,12 +10,30 @@
 #define Emulator_hpp
 
 #include <cstdint>
+#include <memory>
+#include <random>
 #include <string>
+#include <vector>
 
 
 const int displayWidth  = 64;
 const int displayHeight = 32;
 
+class Emulator;
+class TraceBuffer;
+struct CycleModel;
+struct CycleProfile;
+
+// receives every completed frame from Emulator::runFrame(), e.g. to record it.
+class FrameSink
+{
+public:
+    virtual ~FrameSink() {}
+    virtual void frameComplete(const Emulator&) = 0;
+    // called after each cls/Dxyn when attached as Emulator::displaySink.
+    virtual void displayChanged(const Emulator&) {}
+};
+
 class Emulator
 {
 public:
@@ -25,28 +43,157 @@ public:
     uint8_t display[displayHeight][displayWidth];
     bool drawDisplay = false;
     bool waitForKey = false;
+    bool halted = false;        // set on an invalid opcode or stack fault, cleared by reset().
+    uint16_t haltOpcode = 0;
+    
+    int instructionsPerFrame = 10;
+    bool keyWaitOnRelease = false;  // quirk: Fx0A completes when the key is released (COSMAC VIP), not pressed
+    int minKeyHoldFrames = 1;       // queued releases wait until the press has been visible for this many whole frames
+    FrameSink *frameSink = nullptr;
+    FrameSink *displaySink = nullptr;   // sees every display change within a frame (see Phosphor)
+    TraceBuffer *tracer = nullptr;  // attach to record every executed instruction
+    const CycleModel *cycleModel = nullptr;  // set: runFrame() spends machine cycles, not instructionsPerFrame
+    CycleProfile *cycleProfile = nullptr;    // with cycleModel: per-instruction-class totals
     
     int statInstructionCount = 0;
+    uint64_t statTotalInstructions = 0;  // since reset; numbers the trace records
+    uint64_t statTotalCycles = 0;        // machine cycles run under a cycleModel since reset
+    uint64_t statTotalFrames = 0;        // frames run since reset, by runFrame() or Debugger::runFrame()
+    
+    // complete machine state, for save/restore and rewinding.
+    struct State {
+        uint8_t memory[0x1000];
+        uint8_t display[displayHeight][displayWidth];
+        uint8_t vReg[16], keys[16];
+        uint8_t delayTimer, soundTimer;
+        uint16_t pc, I;
+        int8_t sp;
+        uint16_t stack[16];
+        bool waitForKey, halted;
+        uint8_t waitKeyReg;
+        uint16_t haltOpcode;
+        int32_t cycleCarry;
+        std::minstd_rand rndGenerator;
+    };
     
     void reset();
+    // copy-on-write fork: shares memory pages with source (typically a booted
+    // template that is never run again) until one side writes to them. Only
+    // registers, timers, stack and the display are copied; settings such as
+    // instructionsPerFrame and fusion stay as they are.
+    void cloneFrom(const Emulator &source);
     bool loadBinary(const std::string&);
+    bool loadBinary(const uint8_t *data, size_t size);
+    void saveState(State&) const;
+    void loadState(const State&);
+    // whether a state from outside (a file, the network) is safe to load:
+    // sp, pc, I, the stack and Fx0A's register in range, flags 0 or 1.
+    static bool isValidState(const State&);
     void cpuCycle();
+    void runFrame();
+    
+    // superinstructions: runFrame() executes common short sequences (Annn+Dxyn,
+    // 6xkk+6xkk, 7xkk+3xkk+1nnn, Fx1E+Fx65) as one fused operation. Results are
+    // identical to plain dispatch; turn it off to compare.
+    void setFusion(bool);
+    bool getFusion() const { return fused != nullptr; }
+    // input queue: frontends push key events as they arrive and the core applies
+    // them between instructions, in order. An event is not applied before its
+    // instruction number (0: as soon as possible), and a release is held back
+    // until its press has been visible for minKeyHoldFrames, so a tap shorter
+    // than a host frame still reaches the program. Push from the thread that
+    // runs the emulator.
+    void pushKeyEvent(uint8_t key, bool down, uint64_t timestampNs = 0, uint64_t atInstruction = 0);
+    bool inputPending() const { return inputHead != inputTail; }
+    // host timestamp of the oldest input event the display has changed since, or 0;
+    // call when presenting a frame and subtract from now for input-to-display latency.
+    uint64_t takeShownInputTimestamp();
+    static uint64_t timestampNow();
+    
+    // immediate input, for scripted and headless drivers.
     void setKeyPressed(uint8_t);
     void setKeyReleased(uint8_t);
+    void setKeyMask(uint16_t);
+    uint16_t getKeyMask() const;
     bool makeSound();
     
+    // headless helpers: deterministic Cxkk and a compact view of the display.
+    void seedRandom(uint32_t);
+    void packDisplay(uint64_t rows[displayHeight]) const;
+    void packDisplay(uint8_t bytes[displayHeight * displayWidth / 8]) const; // row-major, MSB is leftmost
+    uint64_t displayHash() const;
+    // everything that decides what happens next (memory, registers, stack, timers,
+    // display, keys, Fx0A wait, random state), for deduplicating searches.
+    uint64_t stateHash() const;
+    uint16_t getPC() const { return pc; }
+    uint16_t getI() const { return I; }
+    uint8_t getV(int reg) const { return vReg[reg & 0xF]; }
+    uint8_t peekMemory(uint16_t address) const { return readMemory(address & 0xFFF); }
+    // where the machine is in the current frame and where that frame ends:
+    // instructions of instructionsPerFrame, or under a cycleModel machine cycles
+    // of its budget, with the cycles an instruction took from the previous
+    // frame already run.
+    uint64_t frameTime() const;
+    uint64_t frameLength() const;
+    
     
 private:
-    uint8_t memory[0x1000];
-    uint8_t *font = memory;
+    friend class Debugger;
+    friend class SessionScheduler;
+    friend class StatePublisher;
+    
+    // memory is 16 pages of 256 bytes, shared between clones until written.
+    // Reads go straight through pagePtr; writes (loads, Fx33, Fx55) go through
+    // writableMemory(), which first takes private copies of the page table and
+    // of the page if anyone else still refers to them.
+    enum { pageBits = 8, pageSize = 1 << pageBits, pageCount = 0x1000 / pageSize };
+    struct MemoryPage { uint8_t bytes[pageSize]; };
+    struct MemoryMap { std::shared_ptr<MemoryPage> pages[pageCount]; };
+    std::shared_ptr<MemoryMap> memoryMap;
+    uint8_t *pagePtr[pageCount];
+    // the page instructions are being fetched from. Looking it up through
+    // pagePtr on every fetch would add a load to the pc -> opcode chain.
+    const uint8_t *codePage = nullptr;
+    uint16_t codePageBase = 0xFFFF;     // 0xFFFF: look it up again
+    
     uint8_t vReg[16], keys[16];
     uint8_t delayTimer, soundTimer;
     uint16_t pc, I;
     int8_t sp;
     uint16_t stack[16];
+    uint8_t waitKeyReg = 0;         // Fx0A's x, the register the key goes into
+    uint32_t writes = 0;            // display and Fx33/Fx55 writes, so a scheduler can tell idle frames
+    int cycleCarry = 0;             // cycles the last instruction took from the next frame (<= 0)
+    
+    struct InputEvent {
+        uint64_t atInstruction;
+        uint64_t timestampNs;
+        uint8_t key;
+        bool down;
+    };
+    enum { inputQueueSize = 64 };
+    InputEvent inputQueue[inputQueueSize];
+    uint32_t inputHead = 0, inputTail = 0;
+    uint64_t keyPressedAt[16] = {};     // the first frame each key has been down for all of
+    uint64_t frameStartInstruction = 0; // statTotalInstructions when the current frame began
+    uint64_t frameStartCycle = 0;       // statTotalCycles then, less the carry
+    uint64_t unshownInputTimestamp = 0, shownInputTimestamp = 0;
     
     std::string currentProgram {""};
     
+    std::minstd_rand rndGenerator;
+    
+    // one entry per start address, rebuilt on load and whenever Fx33/Fx55 write
+    // near it; null while fusion is off.
+    struct FusedOp {
+        enum Kind : uint8_t { None, LdIDrw, LdLd, AddSeJp, AddILdMem } kind;
+        uint8_t length;     // instructions in the sequence (most it can execute)
+        uint8_t x, y;
+        uint8_t kk, kk2;    // LdIDrw keeps the sprite height in kk
+        uint16_t nnn;
+    };
+    std::shared_ptr<std::vector<FusedOp>> fused;   // shared by clones like the pages
+    
     
     enum { V0, VF = 0xF};
     
@@ -61,7 +208,7 @@ private:
         };
     };
     
-    void initialize (bool reset=false);
+    void initialize();
     
     typedef void (Emulator::*opcodeFunc)();
     
@@ -93,23 +240,49 @@ private:
         &Emulator::subOpcodeFunc,        // 8xy5
         &Emulator::shrOpcodeFunc,        // 8xy6
         &Emulator::subnOpcodeFunc,       // 8xy7
-        nullptr,                         // ---8
-        nullptr,                         // ---9
-        nullptr,                         // ---A
-        nullptr,                         // ---B
-        nullptr,                         // ---C
-        nullptr,                         // ---D
+        &Emulator::invalidOpcodeFunc,    // ---8
+        &Emulator::invalidOpcodeFunc,    // ---9
+        &Emulator::invalidOpcodeFunc,    // ---A
+        &Emulator::invalidOpcodeFunc,    // ---B
+        &Emulator::invalidOpcodeFunc,    // ---C
+        &Emulator::invalidOpcodeFunc,    // ---D
         &Emulator::shlOpcodeFunc,        // 8xyE,
-        nullptr                          // ---F
+        &Emulator::invalidOpcodeFunc     // ---F
     };
 
 
+    // FrameTimers: the timers are counted down per frame by runCycles(), not per instruction.
+    template <bool Instrumented, bool FrameTimers = false> void execute();
+    // runs one instruction for runCycles() in place of execute(); false ends the
+    // frame there, unfinished (the Debugger stopping).
+    typedef bool (*CycleStep)(Emulator&, void *context);
+    // false if step ended the frame.
+    bool runCycles(CycleStep step = nullptr, void *context = nullptr);
+    // counts a frame and starts the next one; before the frameSink sees it.
+    void frameDone();
+    void applyInput(bool force = false);
+    void keyChanged(uint8_t key, bool down);
+    // the display changed after input: keep the oldest such input for the frontend.
+    void inputShown();
+    void executeFused(int budget);
     void decodeInstr(const uint16_t opcode);
+    
+    uint8_t readMemory(uint16_t address) const { return pagePtr[address >> pageBits][address & (pageSize - 1)]; }
+    uint8_t *writableMemory(uint16_t address);
+    void writeMemory(uint16_t address, const uint8_t *data, size_t size);
+    static const std::shared_ptr<MemoryMap> &blankMemory();
+    
+    void analyzeFusion(uint16_t address);
+    void rebuildFusion();
+    void memoryWritten(uint16_t address, int length);
+    void drawSprite(uint8_t x, uint8_t y, uint8_t height);
+    void loadRegisters(uint8_t last);
 
     void opcodeZeroDispatch();
     void opcodeEightDispatch();
     void opcodeEDispatch();
     void opcodeFDispatch();
+    void invalidOpcodeFunc();
     
     void clsOpcodeFunc();
     void retOpcodeFunc();
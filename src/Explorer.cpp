@@ -0,0 +1,328 @@
+//
+//  Explorer.cpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include "Explorer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "Emulator.hpp"
+
+namespace {
+
+// open addressing over state hashes, sized up front so it never grows; 0 marks a free slot.
+class VisitedSet
+{
+public:
+    explicit VisitedSet(uint64_t expected)
+    {
+        size = 1024;
+        while (size < expected * 2)
+            size <<= 1;
+        slots.reset(new std::atomic<uint64_t>[size]());
+    }
+
+    // true if the hash was not there yet.
+    bool insert(uint64_t hash)
+    {
+        if (!hash)
+            hash = 1;
+        for (uint64_t i = hash & (size - 1);; i = (i + 1) & (size - 1)) {
+            uint64_t seen = slots[i].load(std::memory_order_relaxed);
+            if (seen == 0 && slots[i].compare_exchange_strong(seen, hash))
+                return true;
+            if (seen == hash)
+                return false;
+        }
+    }
+
+private:
+    uint64_t size;
+    std::unique_ptr<std::atomic<uint64_t>[]> slots;
+};
+
+struct Node {
+    std::unique_ptr<Emulator> emulator;
+    uint32_t path;          // this node's entry in Search::paths
+    int depth;
+    int score;
+    uint64_t sequence;      // queue order, to break score ties first-come first-served
+};
+
+struct ByScore {
+    bool operator()(const Node &a, const Node &b) const
+    {
+        if (a.score != b.score)
+            return a.score < b.score;
+        if (a.depth != b.depth)
+            return a.depth > b.depth;
+        return a.sequence > b.sequence;
+    }
+};
+
+struct PathEntry {
+    uint32_t parent;
+    uint16_t keys;
+};
+
+struct Search {
+    const Emulator &start;
+    const std::vector<Explorer::Goal> &goals;
+    const Explorer::Options &options;
+    std::vector<uint16_t> choices;
+    VisitedSet visited;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Node> queue;         // BreadthFirst
+    std::vector<Node> heap;         // BestFirst
+    std::vector<PathEntry> paths;
+    uint64_t sequence = 0;
+    int busy = 0;
+    bool done = false;
+    Explorer::Result result;
+
+    std::atomic<uint64_t> states { 0 }, duplicates { 0 }, dropped { 0 };
+
+    Search(const Emulator &start, const std::vector<Explorer::Goal> &goals, const Explorer::Options &options)
+        : start(start), goals(goals), options(options), visited(options.maxStates + 1)
+    {
+    }
+
+    bool frontierEmpty() const { return queue.empty() && heap.empty(); }
+    size_t frontierSize() const { return queue.size() + heap.size(); }
+
+    Node pop()
+    {
+        Node n;
+        if (options.order == Explorer::Order::BreadthFirst) {
+            n = std::move(queue.front());
+            queue.pop_front();
+        }
+        else {
+            std::pop_heap(heap.begin(), heap.end(), ByScore());
+            n = std::move(heap.back());
+            heap.pop_back();
+        }
+        return n;
+    }
+
+    void push(Node &&n)
+    {
+        n.sequence = sequence++;
+        if (options.order == Explorer::Order::BreadthFirst)
+            queue.push_back(std::move(n));
+        else {
+            heap.push_back(std::move(n));
+            std::push_heap(heap.begin(), heap.end(), ByScore());
+        }
+    }
+
+    int goalReached(const Emulator &emu) const
+    {
+        for (size_t g = 0; g < goals.size(); ++g) {
+            const Explorer::Goal &goal = goals[g];
+            bool hit = false;
+            switch (goal.kind) {
+                case Explorer::Goal::Condition:    hit = Debugger::holds(emu, goal.condition); break;
+                case Explorer::Goal::Halted:       hit = emu.halted; break;
+                case Explorer::Goal::PcOutOfRange: hit = emu.getPC() < 0x200 || emu.getPC() >= 0xFFF; break;
+            }
+            if (hit)
+                return (int)g;
+        }
+        return -1;
+    }
+
+    // call with the mutex held.
+    void found(int goal, uint32_t path, const uint16_t *lastKeys)
+    {
+        if (done)
+            return;
+        result.found = true;
+        result.goal = goal;
+        if (lastKeys)
+            result.inputs.push_back(*lastKeys);
+        for (uint32_t p = path; p != 0; p = paths[p].parent)
+            result.inputs.push_back(paths[p].keys);
+        std::reverse(result.inputs.begin(), result.inputs.end());
+        done = true;
+    }
+
+    void work();
+};
+
+void Search::work()
+{
+    std::vector<std::unique_ptr<Emulator>> spare;
+    std::vector<Node> children;
+    std::vector<uint16_t> childKeys;
+    auto take = [&]() {
+        std::unique_ptr<Emulator> e;
+        if (spare.empty())
+            e.reset(new Emulator);
+        else {
+            e = std::move(spare.back());
+            spare.pop_back();
+        }
+        e->instructionsPerFrame = start.instructionsPerFrame;
+        e->cycleModel = start.cycleModel;
+        return e;
+    };
+
+    for (;;) {
+        Node node;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return done || !frontierEmpty() || busy == 0; });
+            if (done || frontierEmpty()) {
+                // nothing queued and nobody left to queue anything: the space is exhausted.
+                done = true;
+                wake.notify_all();
+                return;
+            }
+            node = pop();
+            ++busy;
+        }
+
+        children.clear();
+        childKeys.clear();
+        int goal = -1;
+        uint16_t goalKeys = 0;
+        for (uint16_t keys : choices) {
+            std::unique_ptr<Emulator> child = take();
+            child->cloneFrom(*node.emulator);
+            child->setKeyMask(keys);
+            for (int f = 0; f < options.framesPerStep && goal < 0; ++f) {
+                child->runFrame();
+                goal = goalReached(*child);
+            }
+            if (goal >= 0) {
+                goalKeys = keys;
+                spare.push_back(std::move(child));
+                break;
+            }
+            // a halted machine goes nowhere, and nothing is expanded past the depth limit.
+            if (child->halted || node.depth + 1 >= options.maxDepth) {
+                spare.push_back(std::move(child));
+                continue;
+            }
+            if (!visited.insert(child->stateHash())) {
+                ++duplicates;
+                spare.push_back(std::move(child));
+                continue;
+            }
+            Node n;
+            n.emulator = std::move(child);
+            n.depth = node.depth + 1;
+            n.score = options.order == Explorer::Order::BestFirst ? Debugger::valueOf(*n.emulator, options.score) : 0;
+            children.push_back(std::move(n));
+            childKeys.push_back(keys);
+        }
+        states += children.size();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --busy;
+            if (goal >= 0)
+                found(goal, node.path, &goalKeys);
+            for (size_t i = 0; i < children.size() && !done; ++i) {
+                if (frontierSize() >= options.maxFrontier) {
+                    dropped += children.size() - i;
+                    break;
+                }
+                children[i].path = (uint32_t)paths.size();
+                paths.push_back({ node.path, childKeys[i] });
+                push(std::move(children[i]));
+            }
+            if (states >= options.maxStates)
+                done = true;
+            wake.notify_all();
+        }
+        for (auto &c : children)
+            if (c.emulator)
+                spare.push_back(std::move(c.emulator));
+        spare.push_back(std::move(node.emulator));
+    }
+}
+
+} // namespace
+
+bool Explorer::parseGoal(const std::string &text, Goal &goal)
+{
+    if (text == "halt") {
+        goal.kind = Goal::Halted;
+        return true;
+    }
+    if (text == "pc-range") {
+        goal.kind = Goal::PcOutOfRange;
+        return true;
+    }
+    goal.kind = Goal::Condition;
+    return Debugger::parseCondition(text, goal.condition);
+}
+
+std::string Explorer::describe(const Goal &goal)
+{
+    switch (goal.kind) {
+        case Goal::Halted:       return "halt";
+        case Goal::PcOutOfRange: return "pc-range";
+        case Goal::Condition:    return Debugger::describe(goal.condition);
+    }
+    return "?";
+}
+
+Explorer::Result Explorer::run(const Emulator &start, const std::vector<Goal> &goals, const Options &options)
+{
+    auto began = std::chrono::steady_clock::now();
+    Search search(start, goals, options);
+    search.choices = options.choices;
+    if (search.choices.empty()) {
+        search.choices.push_back(0);
+        for (int k = 0; k < 16; ++k)
+            search.choices.push_back((uint16_t)(1 << k));
+    }
+
+    Node root;
+    root.emulator.reset(new Emulator);
+    root.emulator->instructionsPerFrame = start.instructionsPerFrame;
+    root.emulator->cycleModel = start.cycleModel;
+    root.emulator->cloneFrom(start);
+    root.path = 0;
+    root.depth = 0;
+    root.score = options.order == Order::BestFirst ? Debugger::valueOf(start, options.score) : 0;
+    search.paths.push_back({ 0, 0 });
+    search.visited.insert(start.stateHash());
+    search.states = 1;
+
+    int goal = search.goalReached(start);
+    if (goal >= 0)
+        search.found(goal, 0, nullptr);
+    else
+        search.push(std::move(root));
+
+    unsigned threads = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; ++t)
+        workers.emplace_back(&Search::work, &search);
+    search.work();
+    for (auto &t : workers)
+        t.join();
+
+    Result result = std::move(search.result);
+    result.states = search.states;
+    result.duplicates = search.duplicates;
+    result.dropped = search.dropped;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+    return result;
+}
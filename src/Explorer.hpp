@@ -0,0 +1,66 @@
+//
+//  Explorer.hpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef Explorer_hpp
+#define Explorer_hpp
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Debugger.hpp"
+
+class Emulator;
+
+// Searches input space for a sequence of key masks that reaches a goal, e.g.
+// a line clear or a crash.
+//
+// From the start state every node is expanded by each choice of key mask held
+// for framesPerStep frames. Children are copy-on-write clones, and any whose
+// Emulator::stateHash() was seen before is dropped, so key masks the program
+// ignores cost one step each rather than a whole subtree. Nodes come off the
+// frontier breadth-first (fewest steps first) or best-first by a score, and
+// are expanded by all cores at once sharing a lock-free visited set.
+class Explorer
+{
+public:
+    enum class Order { BreadthFirst, BestFirst };
+
+    struct Goal {
+        enum Kind { Condition, Halted, PcOutOfRange } kind;
+        Debugger::Condition condition;
+    };
+    // "halt" (invalid opcode or stack fault), "pc-range" (pc below 0x200 or past
+    // the end of memory), or a debugger condition such as "[0x3F0] >= 1".
+    static bool parseGoal(const std::string&, Goal&);
+    static std::string describe(const Goal&);
+
+    struct Options {
+        Order order = Order::BreadthFirst;
+        Debugger::Condition score {};           // BestFirst: higher valueOf() first
+        std::vector<uint16_t> choices;          // key masks; empty: none and each single key
+        int framesPerStep = 4;
+        int maxDepth = 1000;                    // steps
+        uint64_t maxStates = 1000000;           // distinct states before giving up
+        size_t maxFrontier = 100000;            // each queued state is a whole Emulator
+        int threads = 0;                        // 0: one per core
+    };
+
+    struct Result {
+        bool found = false;
+        int goal = -1;                          // index into the goals
+        std::vector<uint16_t> inputs;           // one key mask per step
+        uint64_t states = 0;                    // distinct states reached
+        uint64_t duplicates = 0;                // children dropped as already seen
+        uint64_t dropped = 0;                   // new states not queued because the frontier was full
+        double seconds = 0;
+    };
+
+    static Result run(const Emulator &start, const std::vector<Goal>&, const Options&);
+};
+
+#endif /* Explorer_hpp */
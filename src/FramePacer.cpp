@@ -0,0 +1,80 @@
+//
+//  FramePacer.cpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include "FramePacer.hpp"
+
+#include <algorithm>
+
+#include "Emulator.hpp"
+
+FramePacer::FramePacer(const double frameRate)
+    : frameRate(frameRate), last(Clock::now()), windowStart(last)
+{
+}
+
+void FramePacer::setFastForward(const bool on)
+{
+    fastForward = on;
+    // start counting afresh so neither mode inherits the other's backlog.
+    owed = 0;
+    last = Clock::now();
+}
+
+int FramePacer::advance(Emulator &emulator, const double hostFrameSeconds)
+{
+    return advance(emulator, hostFrameSeconds, [](Emulator &e) {
+        e.runFrame();
+        return true;
+    });
+}
+
+int FramePacer::advance(Emulator &emulator, const double hostFrameSeconds,
+                        const std::function<bool(Emulator&)> &runFrame)
+{
+    auto start = Clock::now();
+    double elapsed = std::chrono::duration<double>(start - last).count();
+    last = start;
+
+    // never spend more than most of a host frame emulating, or the frontend
+    // stops presenting and polling input; whatever does not fit is dropped.
+    auto budget = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(hostFrameSeconds * 0.8));
+    bool unlimited = fastForward && multiple <= 0;
+    double speed = fastForward ? multiple : 1.0;
+    if (!unlimited)
+        owed = std::min(owed + elapsed * frameRate * speed, frameRate * speed * 0.25 + 1);
+
+    int frames = 0;
+    for (;;) {
+        if (!unlimited && owed < 1)
+            break;
+        bool carryOn = runFrame(emulator);
+        ++frames;
+        if (!carryOn) {
+            owed = 0;
+            break;
+        }
+        if (!unlimited)
+            owed -= 1;
+        // nothing changes until the frontend delivers a key; don't spin on it.
+        else if (emulator.waitForKey || emulator.halted)
+            break;
+        // the clock is only read every few frames; a frame takes well under a microsecond.
+        if ((frames & 7) == 0 && Clock::now() >= budget) {
+            owed = 0;
+            break;
+        }
+    }
+
+    windowFrames += frames;
+    double window = std::chrono::duration<double>(start - windowStart).count();
+    if (window >= 1.0) {
+        achieved = windowFrames / (window * frameRate);
+        windowStart = start;
+        windowFrames = 0;
+    }
+    return frames;
+}
@@ -0,0 +1,56 @@
+//
+//  FramePacer.hpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef FramePacer_hpp
+#define FramePacer_hpp
+
+#include <chrono>
+#include <functional>
+
+class Emulator;
+
+// Decides how many emulated frames a frontend runs per host frame.
+//
+// At normal speed that is whatever 60 Hz of wall time has accumulated. In
+// fast-forward it is that times the multiple, or with a multiple of 0 as many
+// as fit into most of the host frame. Frontends present once per advance(),
+// so the frames in between are never drawn (render decimation), and should
+// mute audio while isFastForward().
+class FramePacer
+{
+public:
+    explicit FramePacer(double frameRate = 60.0);
+
+    void setFastForward(bool on);
+    bool isFastForward() const { return fastForward; }
+    void setMultiple(double multiple) { this->multiple = multiple; } // 0 = unlimited
+    double getMultiple() const { return multiple; }
+
+    // runs the frames that are due since the last call; hostFrameSeconds is
+    // the frontend's own frame period, which bounds the time spent in here.
+    int advance(Emulator&, double hostFrameSeconds);
+    // the same with runFrame in place of Emulator::runFrame(), e.g. to go
+    // through a Debugger; when it returns false the frames still owed are dropped.
+    int advance(Emulator&, double hostFrameSeconds, const std::function<bool(Emulator&)> &runFrame);
+
+    // emulated time / wall time over roughly the last second.
+    double achievedMultiple() const { return achieved; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    double frameRate;
+    bool fastForward = false;
+    double multiple = 4;
+    double owed = 0;              // frames due but not yet run
+    Clock::time_point last;
+    Clock::time_point windowStart;
+    long windowFrames = 0;
+    double achieved = 1;
+};
+
+#endif /* FramePacer_hpp */
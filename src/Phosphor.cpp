@@ -0,0 +1,145 @@
+//
+//  Phosphor.cpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include "Phosphor.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+const int pixelCount = displayHeight * displayWidth;
+const unsigned fullFrame = 256;     // on-time of a pixel lit for a whole frame
+}
+
+Phosphor::Phosphor(const float decay)
+{
+    setDecay(decay);
+    reset();
+}
+
+void Phosphor::setDecay(const float decay)
+{
+    decayMul = (uint16_t)(std::min(std::max(decay, 0.0f), 1.0f) * 256.0f + 0.5f);
+}
+
+void Phosphor::reset()
+{
+    std::memset(onTime, 0, sizeof(onTime));
+    std::memset(intensity, 0, sizeof(intensity));
+    std::memset(current, 0, sizeof(current));
+    segmentStart = 0;
+    segmentFrame = ~0ull;
+    frameWeight = 0;
+    lastChanged = true;
+}
+
+void Phosphor::displayChanged(const Emulator &emulator)
+{
+    // the instruction that made the change is not counted yet, so the old
+    // image is credited up to and including it; under a cycleModel its cycles
+    // are only known afterwards.
+    uint64_t now = emulator.frameTime() + (emulator.cycleModel ? 0 : 1);
+    uint64_t shown = emulator.statTotalFrames == segmentFrame && now >= segmentStart ? now - segmentStart : 0;
+    unsigned weight = (unsigned)std::min<uint64_t>(fullFrame - frameWeight, shown * fullFrame / emulator.frameLength());
+    if (weight) {
+        accumulate(weight);
+        frameWeight += weight;
+    }
+    emulator.packDisplay(current);
+    segmentStart = now;
+    segmentFrame = emulator.statTotalFrames;
+}
+
+void Phosphor::frameComplete(const Emulator &emulator)
+{
+    // whatever is up at the end of the frame gets the rest of it, which also
+    // covers frames spent waiting for a key.
+    accumulate(fullFrame - frameWeight);
+    resolve();
+    frameWeight = 0;
+    emulator.packDisplay(current);    // in case the display was replaced wholesale (loadState, reset)
+    segmentStart = emulator.frameTime();
+    segmentFrame = emulator.statTotalFrames;
+    if (next)
+        next->frameComplete(emulator);
+}
+
+void Phosphor::accumulate(const unsigned weight)
+{
+    if (!weight)
+        return;
+#if defined(__SSE2__)
+    // spread each byte of a row over eight 16-bit lanes, one bit per lane.
+    const __m128i bits = _mm_setr_epi16(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    const __m128i add = _mm_set1_epi16((short)weight);
+    for (int y = 0; y < displayHeight; ++y) {
+        const uint64_t row = current[y];
+        if (!row)
+            continue;
+        for (int b = 0; b < displayWidth / 8; ++b) {
+            const int byte = (row >> (56 - b * 8)) & 0xFF;
+            if (!byte)
+                continue;
+            __m128i lit = _mm_cmpeq_epi16(_mm_and_si128(_mm_set1_epi16((short)byte), bits), bits);
+            __m128i *p = reinterpret_cast<__m128i *>(&onTime[y][b * 8]);
+            _mm_storeu_si128(p, _mm_add_epi16(_mm_loadu_si128(p), _mm_and_si128(lit, add)));
+        }
+    }
+#else
+    for (int y = 0; y < displayHeight; ++y) {
+        const uint64_t row = current[y];
+        if (!row)
+            continue;
+        for (int x = 0; x < displayWidth; ++x)
+            if ((row >> (displayWidth - 1 - x)) & 1)
+                onTime[y][x] += weight;
+    }
+#endif
+}
+
+void Phosphor::resolve()
+{
+    uint16_t *on = &onTime[0][0];
+    uint8_t *out = &intensity[0][0];
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i top = _mm_set1_epi16(255);
+    const __m128i mul = _mm_set1_epi16((short)decayMul);
+    __m128i diff = zero;
+    for (int i = 0; i < pixelCount; i += 16) {
+        __m128i old = _mm_loadu_si128(reinterpret_cast<const __m128i *>(out + i));
+        // old * decay fits in 16 bits (255 * 256), so the low half of the product is exact.
+        __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(old, zero), mul), 8);
+        __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(old, zero), mul), 8);
+        __m128i *onLo = reinterpret_cast<__m128i *>(on + i);
+        __m128i *onHi = reinterpret_cast<__m128i *>(on + i + 8);
+        lo = _mm_max_epi16(lo, _mm_min_epi16(_mm_loadu_si128(onLo), top));
+        hi = _mm_max_epi16(hi, _mm_min_epi16(_mm_loadu_si128(onHi), top));
+        __m128i now = _mm_packus_epi16(lo, hi);
+        diff = _mm_or_si128(diff, _mm_xor_si128(now, old));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), now);
+        _mm_storeu_si128(onLo, zero);
+        _mm_storeu_si128(onHi, zero);
+    }
+    lastChanged = _mm_movemask_epi8(_mm_cmpeq_epi8(diff, zero)) != 0xFFFF;
+#else
+    bool any = false;
+    for (int i = 0; i < pixelCount; ++i) {
+        unsigned lit = std::min<unsigned>(on[i], 255);
+        unsigned faded = out[i] * decayMul >> 8;
+        uint8_t now = (uint8_t)std::max(lit, faded);
+        any |= now != out[i];
+        out[i] = now;
+        on[i] = 0;
+    }
+    lastChanged = any;
+#endif
+}
@@ -0,0 +1,62 @@
+//
+//  Phosphor.hpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef Phosphor_hpp
+#define Phosphor_hpp
+
+#include <cstdint>
+
+#include "Emulator.hpp"
+
+// Composites the display like a slow phosphor, so XOR erase/redraw flicker
+// blends into steady sprites.
+//
+// Attach as both the emulator's displaySink and frameSink. Every cls/Dxyn,
+// the image that was up until then is added to a per-pixel on-time count,
+// weighted by how much of the frame it was visible for (Emulator::frameTime():
+// instructions, or machine cycles under a cycleModel); at the end of the
+// frame each pixel's brightness becomes the larger of its on-time this frame
+// and its previous brightness times the decay. All of it works on the packed
+// rows, eight or sixteen pixels per SSE2 operation where available.
+//
+// pixels() is the result as 8-bit brightness, for a texture or for
+// VideoRecorder::Stream::pushLuma(). frameComplete() is passed on to next,
+// so a recorder or publisher can still be attached behind it.
+class Phosphor : public FrameSink
+{
+public:
+    // decay: fraction of brightness a pixel keeps per frame once it is off.
+    explicit Phosphor(float decay = 0.6f);
+
+    void setDecay(float decay);
+    float getDecay() const { return decayMul / 256.0f; }
+    void reset();
+
+    void displayChanged(const Emulator&) override;
+    void frameComplete(const Emulator&) override;
+    FrameSink *next = nullptr;
+
+    // [displayHeight][displayWidth], 0 (off) .. 255 (lit all frame)
+    const uint8_t *pixels() const { return &intensity[0][0]; }
+    // whether the last frame changed any pixel; false once everything has settled.
+    bool changed() const { return lastChanged; }
+
+private:
+    uint16_t onTime[displayHeight][displayWidth];
+    uint8_t intensity[displayHeight][displayWidth];
+    uint64_t current[displayHeight];    // the image since the last change
+    uint64_t segmentStart = 0;          // frameTime() when it went up
+    uint64_t segmentFrame = ~0ull;      // statTotalFrames then; ~0 if unknown
+    unsigned frameWeight = 0;           // weight given out this frame, of 256
+    uint16_t decayMul;
+    bool lastChanged = true;
+
+    void accumulate(unsigned weight);
+    void resolve();
+};
+
+#endif /* Phosphor_hpp */
@@ -0,0 +1,257 @@
+//
+//  RollbackLink.cpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include "RollbackLink.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+const uint32_t packetMagic = 0x504E3843;    // "C8NP"
+const size_t packetHeader = 32;             // Packet without its inputs
+}
+
+RollbackLink::RollbackLink(Emulator &emu, const Options &options)
+    : emu(emu), options(options)
+{
+    static_assert(offsetof(Packet, inputs) == packetHeader, "packet header layout");
+    uint64_t hash = emu.stateHash();
+    session = (uint32_t)(hash ^ (hash >> 32));
+    // inputs for the whole prediction window must fit in the history and in one packet.
+    this->options.maxRollback = std::max(1, std::min(options.maxRollback, historySize / 2 - 1));
+    this->options.inputDelay = std::max(0, std::min(options.inputDelay, historySize / 4));
+    this->options.simulatedLatency = std::max(0, options.simulatedLatency);
+}
+
+RollbackLink::~RollbackLink()
+{
+    close();
+}
+
+bool RollbackLink::open(const int localPort, const std::string &host, const int port)
+{
+    close();
+    struct addrinfo hints = {}, *remote = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &remote) != 0 || !remote)
+        return false;
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons((uint16_t)localPort);
+    // connected, so only the peer's datagrams come in and send() needs no address.
+    bool ok = fd >= 0 && bind(fd, (struct sockaddr *)&local, sizeof(local)) == 0 &&
+              connect(fd, remote->ai_addr, remote->ai_addrlen) == 0 &&
+              fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0;
+    freeaddrinfo(remote);
+    if (!ok) {
+        if (fd >= 0)
+            ::close(fd);
+        return false;
+    }
+    socketFd = fd;
+    return true;
+}
+
+void RollbackLink::close()
+{
+    if (socketFd >= 0)
+        ::close(socketFd);
+    socketFd = -1;
+    delayed.clear();
+}
+
+bool RollbackLink::advance(const uint16_t localKeys)
+{
+    receive();
+    if (rollbackFrom < current)
+        resimulate();
+    rollbackFrom = ~0ull;
+    recordSync();
+
+    // both sides see the other through the same latency, so half the
+    // difference of their views is how far apart they really are.
+    int advantage = (int)((int64_t)current - (int64_t)remoteLatest);
+    statistics.frameAdvantage = (advantage - remoteAdvantage) / 2;
+    bool wait = current >= remoteConfirmed + (uint64_t)options.maxRollback;
+    // a peer that stays ahead makes the other roll back on every change; drop back now and then.
+    if (!wait && heard && statistics.frameAdvantage > 1 && current % 8 == 0)
+        wait = true;
+    if (wait) {
+        ++statistics.stalls;
+        send(current + options.inputDelay);
+        return false;
+    }
+
+    localInputs[(current + options.inputDelay) % historySize] = localKeys;
+    send(current + options.inputDelay + 1);
+    runFrame(current);
+    ++current;
+    ++statistics.frames;
+    recordSync();
+    return true;
+}
+
+uint16_t RollbackLink::remoteInputFor(const uint64_t f) const
+{
+    if (f < remoteConfirmed)
+        return remoteInputs[f % historySize];
+    // most of the time nobody changes keys: predict the last ones we know.
+    return remoteConfirmed ? remoteInputs[(remoteConfirmed - 1) % historySize] : 0;
+}
+
+void RollbackLink::runFrame(const uint64_t f)
+{
+    history[f % historySize].cloneFrom(emu);
+    remoteInputs[f % historySize] = remoteInputFor(f);
+    emu.setKeyMask(localInputs[f % historySize] | remoteInputs[f % historySize]);
+    emu.runFrame();
+}
+
+void RollbackLink::resimulate()
+{
+    auto start = std::chrono::steady_clock::now();
+    const uint64_t from = rollbackFrom, to = current;
+    emu.cloneFrom(history[from % historySize]);
+    // those frames were already shown; recorders and publishers see each one once.
+    FrameSink *frameSink = emu.frameSink, *displaySink = emu.displaySink;
+    emu.frameSink = emu.displaySink = nullptr;
+    for (uint64_t f = from; f < to; ++f)
+        runFrame(f);
+    emu.frameSink = frameSink;
+    emu.displaySink = displaySink;
+
+    int depth = (int)(to - from);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    ++statistics.rollbacks;
+    statistics.resimulatedFrames += depth;
+    statistics.lastRollbackDepth = depth;
+    statistics.maxRollbackDepth = std::max(statistics.maxRollbackDepth, depth);
+    statistics.lastResimulationMs = ms;
+    statistics.maxResimulationMs = std::max(statistics.maxResimulationMs, ms);
+}
+
+void RollbackLink::recordSync()
+{
+    // the state before frame s is final once every input below s is.
+    uint64_t s = std::min(current, remoteConfirmed) / syncInterval * syncInterval;
+    if (s == 0 || (lastSync.frame != ~0u && s <= lastSync.frame) || s + historySize <= current)
+        return;
+    lastSync.frame = (uint32_t)s;
+    lastSync.hash = s == current ? emu.stateHash() : history[s % historySize].stateHash();
+    syncs[s / syncInterval % syncRecords] = lastSync;
+}
+
+void RollbackLink::receive()
+{
+    if (socketFd < 0)
+        return;
+    Packet p;
+    for (;;) {
+        ssize_t n = recv(socketFd, &p, sizeof(p), 0);
+        if (n < 0) {
+            // ECONNREFUSED: the peer is not up yet, reported once; keep going.
+            // EAGAIN means drained; anything else would fail again, so the next
+            // advance() tries afresh.
+            if (errno == EINTR || errno == ECONNREFUSED)
+                continue;
+            return;
+        }
+        statistics.bytesReceived += n;
+        if ((size_t)n < packetHeader || p.magic != packetMagic || p.session != session ||
+            p.count > maxPacketInputs || (size_t)n != packetHeader + p.count * sizeof(uint16_t)) {
+            ++statistics.packetsRejected;
+            continue;
+        }
+        ++statistics.packetsReceived;
+        accept(p, p.count);
+    }
+}
+
+void RollbackLink::accept(const Packet &p, const size_t inputCount)
+{
+    heard = true;
+    remoteAcked = std::max<uint64_t>(remoteAcked, p.ack);
+    remoteLatest = std::max<uint64_t>(remoteLatest, (uint64_t)p.first + inputCount);
+    remoteAdvantage = p.advantage;
+
+    // packets start at our ack, so the inputs extend what we have without gaps
+    // unless they were reordered; those are simply sent again.
+    for (size_t i = 0; i < inputCount; ++i) {
+        uint64_t f = (uint64_t)p.first + i;
+        if (f < remoteConfirmed)
+            continue;
+        if (f > remoteConfirmed || f >= current + historySize / 2)
+            break;
+        uint16_t keys = p.inputs[i];
+        if (f < current && remoteInputs[f % historySize] != keys)
+            rollbackFrom = std::min(rollbackFrom, f);
+        remoteInputs[f % historySize] = keys;
+        ++remoteConfirmed;
+    }
+
+    if (p.syncFrame != ~0u && p.syncFrame != syncChecked) {
+        const SyncRecord &mine = syncs[p.syncFrame / syncInterval % syncRecords];
+        if (mine.frame == p.syncFrame) {
+            syncChecked = p.syncFrame;
+            ++statistics.syncChecks;
+            if (mine.hash != p.syncHash)
+                ++statistics.desyncs;
+        }
+    }
+}
+
+void RollbackLink::send(const uint64_t localKnown)
+{
+    Packet p;
+    p.magic = packetMagic;
+    p.session = session;
+    p.ack = (uint32_t)remoteConfirmed;
+    p.syncFrame = lastSync.frame;
+    p.syncHash = lastSync.hash;
+    p.first = (uint32_t)std::min(remoteAcked, localKnown);
+    p.count = (uint16_t)std::min<uint64_t>(localKnown - p.first, maxPacketInputs);
+    p.advantage = (int16_t)std::max<int64_t>(-32768, std::min<int64_t>(32767, (int64_t)current - (int64_t)remoteLatest));
+    for (uint16_t i = 0; i < p.count; ++i)
+        p.inputs[i] = localInputs[(p.first + i) % historySize];
+    size_t length = packetHeader + p.count * sizeof(uint16_t);
+
+    if (!options.simulatedLatency) {
+        sendBytes(&p, length);
+        return;
+    }
+    const char *bytes = reinterpret_cast<const char *>(&p);
+    delayed.emplace_back(bytes, bytes + length);
+    while (delayed.size() > (size_t)options.simulatedLatency) {
+        sendBytes(delayed.front().data(), delayed.front().size());
+        delayed.pop_front();
+    }
+}
+
+void RollbackLink::sendBytes(const void *data, const size_t length)
+{
+    if (socketFd < 0)
+        return;
+    ssize_t n = ::send(socketFd, data, length, 0);
+    if (n < 0)
+        return;     // the peer not listening yet is normal; the next packet repeats everything
+    ++statistics.packetsSent;
+    statistics.bytesSent += n;
+}
@@ -0,0 +1,125 @@
+//
+//  RollbackLink.hpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef RollbackLink_hpp
+#define RollbackLink_hpp
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "Emulator.hpp"
+
+// Two-player play between two processes over UDP, without input lag.
+//
+// Both peers run the same ROM from the same state and advance one frame per
+// call with their own key mask. The other player's keys for that frame are
+// usually not here yet, so they are predicted (the last keys received) and
+// the frame runs at once. When the real keys arrive and differ, the emulator
+// goes back to the state before the first wrong frame (the link keeps a
+// copy-on-write clone per frame) and runs the frames up to now again with the
+// right keys, all inside the same advance(). A peer that gets more than
+// maxRollback frames ahead of what it has heard waits instead.
+//
+// Each frame the emulator's keys are local | remote, so each player uses
+// their own keys (Pong: 1/4 against C/D). Every packet carries all local
+// inputs the other side has not acknowledged, so lost packets need no
+// resend, and now and then a hash of a frame both sides have final inputs
+// for, which counts desyncs. Peers share byte order.
+class RollbackLink
+{
+public:
+    struct Options {
+        int maxRollback = 12;       // frames of prediction before advance() waits
+        int inputDelay = 0;         // frames local keys are held back; trades lag for fewer rollbacks
+        int simulatedLatency = 0;   // hold each outgoing packet this many frames (loopback testing)
+    };
+
+    struct Stats {
+        uint64_t frames = 0;             // frames advanced
+        uint64_t stalls = 0;             // advance() calls that waited for the other peer
+        uint64_t rollbacks = 0;
+        uint64_t resimulatedFrames = 0;
+        int lastRollbackDepth = 0;       // frames re-run by the latest rollback
+        int maxRollbackDepth = 0;
+        double lastResimulationMs = 0;   // time the latest rollback took
+        double maxResimulationMs = 0;
+        uint64_t packetsSent = 0, packetsReceived = 0, packetsRejected = 0;
+        uint64_t bytesSent = 0, bytesReceived = 0;
+        uint64_t syncChecks = 0, desyncs = 0;
+        int frameAdvantage = 0;          // how far this peer is ahead of the other one
+    };
+
+    // the session key is the emulator's stateHash() now: packets from a peer
+    // with another ROM, seed or start state are rejected.
+    RollbackLink(Emulator&, const Options&);
+    ~RollbackLink();
+
+    // binds localPort and sends to host:port. false (errno set) on failure.
+    bool open(int localPort, const std::string &host, int port);
+    void close();
+
+    // runs one frame with these local keys; false if it had to wait for the
+    // other peer instead (call again next host frame).
+    bool advance(uint16_t localKeys);
+
+    uint64_t frame() const { return current; }
+    bool connected() const { return heard; }
+    const Stats &stats() const { return statistics; }
+
+private:
+    enum { historySize = 64, syncInterval = 16, syncRecords = 8, maxPacketInputs = 64 };
+
+    struct Packet {
+        uint32_t magic;
+        uint32_t session;
+        uint32_t ack;           // the sender has the receiver's inputs for all frames below this
+        uint32_t syncFrame;     // ~0 if none yet
+        uint64_t syncHash;      // stateHash() before syncFrame ran
+        uint32_t first;         // frame of inputs[0]
+        uint16_t count;
+        int16_t advantage;      // sender's frame minus the newest frame it has from the receiver
+        uint16_t inputs[maxPacketInputs];
+    };
+    struct SyncRecord {
+        uint32_t frame = ~0u;
+        uint64_t hash = 0;
+    };
+
+    Emulator &emu;
+    Options options;
+    uint32_t session;
+    int socketFd = -1;
+
+    Emulator history[historySize];      // state before frame f, at f % historySize
+    uint16_t localInputs[historySize] = {};
+    uint16_t remoteInputs[historySize] = {};    // confirmed, or the prediction a frame ran with
+    uint64_t current = 0;               // the next frame to run
+    uint64_t remoteConfirmed = 0;       // remote inputs are final for all frames below this
+    uint64_t remoteAcked = 0;           // the other peer has our inputs below this
+    uint64_t remoteLatest = 0;          // one past the newest frame the other peer sent inputs for
+    uint64_t rollbackFrom = ~0ull;
+    bool heard = false;
+    SyncRecord syncs[syncRecords];
+    SyncRecord lastSync;                // newest local record, sent with every packet
+    uint32_t syncChecked = ~0u;         // the other peer's last record compared
+    int remoteAdvantage = 0;
+    std::deque<std::vector<char>> delayed;
+    Stats statistics;
+
+    void receive();
+    void accept(const Packet&, size_t inputCount);
+    void resimulate();
+    void runFrame(uint64_t f);
+    void recordSync();
+    void send(uint64_t localKnown);
+    void sendBytes(const void *data, size_t length);
+    uint16_t remoteInputFor(uint64_t f) const;
+};
+
+#endif /* RollbackLink_hpp */
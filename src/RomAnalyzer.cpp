@@ -0,0 +1,409 @@
+//
+//  RomAnalyzer.cpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include "RomAnalyzer.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+
+#include "Disassembler.hpp"
+
+namespace {
+
+const unsigned origin = 0x200;
+const unsigned memorySize = 0x1000;
+const size_t maxJumpTable = 128;
+
+bool isSkip(uint16_t opcode)
+{
+    switch (opcode >> 12) {
+        case 0x3: case 0x4: case 0x5: case 0x9: case 0xE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// whether the instruction ends a basic block.
+bool endsBlock(uint16_t opcode)
+{
+    const unsigned hi = opcode >> 12;
+    return hi == 0x1 || hi == 0x2 || hi == 0xB || opcode == 0x00EE || isSkip(opcode) || !isValidOpcode(opcode);
+}
+
+std::string hex(unsigned value, int digits = 3)
+{
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "0x%0*X", digits, value);
+    return buf;
+}
+
+std::string quoted(const std::string &s)
+{
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+} // namespace
+
+const char *RomAnalysis::kindName(const Finding::Kind kind)
+{
+    switch (kind) {
+        case Finding::InvalidOpcode:    return "invalid-opcode";
+        case Finding::OutsideRom:       return "outside-rom";
+        case Finding::ComputedJump:     return "computed-jump";
+        case Finding::SelfModification: return "self-modification";
+        case Finding::UnresolvedWrite:  return "unresolved-write";
+        case Finding::Overlap:          return "overlap";
+        case Finding::MachineCall:      return "machine-call";
+    }
+    return "?";
+}
+
+const char *RomAnalysis::exitName(const Exit exit)
+{
+    switch (exit) {
+        case Exit::FallThrough: return "fall-through";
+        case Exit::Jump:        return "jump";
+        case Exit::Call:        return "call";
+        case Exit::Return:      return "return";
+        case Exit::Skip:        return "skip";
+        case Exit::Computed:    return "computed";
+        case Exit::Halt:        return "halt";
+        case Exit::End:         return "end";
+    }
+    return "?";
+}
+
+RomAnalysis RomAnalysis::analyze(const uint8_t *rom, size_t size)
+{
+    RomAnalysis a;
+    a.romSize = std::min<size_t>(size, memorySize - origin);
+    a.memory.assign(memorySize, 0);
+    std::copy(rom, rom + a.romSize, a.memory.begin() + origin);
+    const unsigned end = origin + (unsigned)a.romSize;
+    auto opcodeAt = [&](unsigned addr) -> uint16_t { return (a.memory[addr] << 8) | a.memory[addr + 1]; };
+    auto inRom = [&](unsigned addr) { return addr >= origin && addr + 2 <= end; };
+    auto report = [&](Finding::Kind kind, unsigned addr, const std::string &detail) {
+        a.findings.push_back({ kind, (uint16_t)addr, opcodeAt(addr), detail });
+    };
+
+    // find every reachable instruction, marking where blocks must start.
+    std::vector<bool> decoded(memorySize), leader(memorySize);
+    std::map<unsigned, std::vector<uint16_t>> calls;        // entry -> 2nnn addresses
+    std::map<unsigned, std::vector<uint16_t>> computed;     // Bnnn address -> targets
+    std::vector<unsigned> references;                       // Annn targets
+    std::vector<unsigned> work;
+    auto branch = [&](unsigned from, unsigned to) {
+        if (!inRom(to)) {
+            report(Finding::OutsideRom, from, "to " + hex(to));
+            return false;
+        }
+        leader[to] = true;
+        work.push_back(to);
+        return true;
+    };
+    if (inRom(origin)) {
+        leader[origin] = true;
+        work.push_back(origin);
+    }
+    while (!work.empty()) {
+        unsigned pc = work.back();
+        work.pop_back();
+        // straight-line code until the path ends or joins code already decoded.
+        for (;;) {
+            if (decoded[pc]) {
+                leader[pc] = true;
+                break;
+            }
+            decoded[pc] = true;
+            const uint16_t opcode = opcodeAt(pc);
+            const unsigned nnn = opcode & 0xFFF;
+            if (!isValidOpcode(opcode)) {
+                report(Finding::InvalidOpcode, pc, disassemble(opcode));
+                break;
+            }
+            if (opcode == 0x00EE)
+                break;
+            if ((opcode >> 12) == 0x1) {
+                branch(pc, nnn);
+                break;
+            }
+            if ((opcode >> 12) == 0xB) {
+                // a table of jumps at nnn is the usual pattern; follow its entries.
+                std::vector<uint16_t> &targets = computed[pc];
+                for (unsigned t = nnn; inRom(t) && (opcodeAt(t) >> 12) == 0x1 && targets.size() < maxJumpTable; t += 2)
+                    targets.push_back((uint16_t)t);
+                if (targets.empty() && inRom(nnn))
+                    targets.push_back((uint16_t)nnn);
+                for (uint16_t t : targets)
+                    branch(pc, t);
+                report(Finding::ComputedJump, pc, targets.size() > 1
+                       ? "jump table of " + std::to_string(targets.size()) + " entries at " + hex(nnn)
+                       : "target " + hex(nnn) + " + V0 not known");
+                break;
+            }
+            if ((opcode >> 12) == 0x2) {
+                if (branch(pc, nnn))
+                    calls[nnn].push_back((uint16_t)pc);
+            }
+            else if ((opcode >> 12) == 0x0 && opcode != 0x00E0)
+                report(Finding::MachineCall, pc, "ignored");
+            else if ((opcode >> 12) == 0xA)
+                references.push_back(nnn);
+
+            if (isSkip(opcode))
+                branch(pc, pc + 4);
+            const unsigned next = pc + 2;
+            if (!inRom(next)) {
+                report(Finding::OutsideRom, pc, "runs past the end of the ROM");
+                break;
+            }
+            if (endsBlock(opcode))
+                leader[next] = true;
+            pc = next;
+        }
+    }
+
+    // instructions that start on another instruction's second byte.
+    std::vector<bool> code(memorySize);
+    for (unsigned addr = origin; addr < end; ++addr) {
+        if (!decoded[addr])
+            continue;
+        ++a.instructions;
+        code[addr] = code[addr + 1] = true;
+        if (addr > origin && decoded[addr - 1])
+            report(Finding::Overlap, addr, "inside the instruction at " + hex(addr - 1));
+    }
+    a.codeBytes = std::count(code.begin(), code.end(), true);
+
+    // basic blocks, one per leader.
+    for (unsigned start = origin; start < end; ++start) {
+        if (!leader[start] || !decoded[start])
+            continue;
+        Block b;
+        b.start = (uint16_t)start;
+        unsigned pc = start;
+        // I as far as this block knows; memorySize: not known.
+        unsigned I = memorySize;
+        for (;;) {
+            const uint16_t opcode = opcodeAt(pc);
+            const unsigned nnn = opcode & 0xFFF, x = (opcode >> 8) & 0xF, kk = opcode & 0xFF;
+            if ((opcode >> 12) == 0xA)
+                I = nnn;
+            else if ((opcode >> 12) == 0xF && kk == 0x1E)
+                I = memorySize;
+            else if ((opcode >> 12) == 0xF && (kk == 0x33 || kk == 0x55)) {
+                const unsigned count = kk == 0x33 ? 3 : x + 1;
+                if (I == memorySize)
+                    report(Finding::UnresolvedWrite, pc, "I not known in this block");
+                else {
+                    for (unsigned w = I; w < I + count; ++w) {
+                        if (code[w & 0xFFF]) {
+                            report(Finding::SelfModification, pc, "writes " + hex(I) + "-" + hex(I + count - 1)
+                                   + ", code at " + hex(w & 0xFFF));
+                            break;
+                        }
+                    }
+                }
+            }
+
+            const unsigned next = pc + 2;
+            if (endsBlock(opcode)) {
+                switch (opcode >> 12) {
+                    case 0x0:
+                        b.exit = opcode == 0x00EE ? Exit::Return : Exit::Halt;
+                        break;
+                    case 0x1:
+                        b.exit = Exit::Jump;
+                        if (inRom(nnn))
+                            b.successors.push_back((uint16_t)nnn);
+                        break;
+                    case 0x2:
+                        b.exit = Exit::Call;
+                        if (inRom(nnn))
+                            b.successors.push_back((uint16_t)nnn);
+                        if (decoded[next])
+                            b.successors.push_back((uint16_t)next);
+                        break;
+                    case 0xB:
+                        b.exit = Exit::Computed;
+                        b.successors = computed[pc];
+                        break;
+                    default:
+                        if (!isValidOpcode(opcode))
+                            b.exit = Exit::Halt;
+                        else {
+                            b.exit = Exit::Skip;
+                            if (decoded[next])
+                                b.successors.push_back((uint16_t)next);
+                            if (decoded[pc + 4])
+                                b.successors.push_back((uint16_t)(pc + 4));
+                        }
+                        break;
+                }
+                pc = next;
+                break;
+            }
+            pc = next;
+            if (!decoded[pc]) {
+                b.exit = Exit::End;
+                break;
+            }
+            if (leader[pc]) {
+                b.exit = Exit::FallThrough;
+                b.successors.push_back((uint16_t)pc);
+                break;
+            }
+        }
+        b.end = (uint16_t)pc;
+        a.blocks.push_back(b);
+    }
+
+    // subroutines: the blocks reachable from each entry without entering calls.
+    std::vector<unsigned> entries;
+    if (!a.blocks.empty())
+        entries.push_back(origin);
+    for (auto &c : calls)
+        if (c.first != origin)
+            entries.push_back(c.first);
+    std::vector<bool> assigned(a.blocks.size());
+    for (unsigned entry : entries) {
+        Subroutine s;
+        s.entry = (uint16_t)entry;
+        if (calls.count(entry))
+            s.callers = calls[entry];
+        std::vector<bool> seen(a.blocks.size());
+        std::vector<uint16_t> stack = { (uint16_t)entry };
+        while (!stack.empty()) {
+            const Block *b = a.blockAt(stack.back());
+            stack.pop_back();
+            if (!b)
+                continue;
+            size_t i = b - a.blocks.data();
+            if (seen[i])
+                continue;
+            seen[i] = true;
+            if (!assigned[i]) {
+                a.blocks[i].subroutine = (uint16_t)entry;
+                assigned[i] = true;
+            }
+            if (b->exit == Exit::Return)
+                s.returns = true;
+            for (uint16_t next : b->successors)
+                if (b->exit != Exit::Call || next == b->end)
+                    stack.push_back(next);
+        }
+        a.subroutines.push_back(s);
+    }
+    std::sort(a.subroutines.begin() + (a.subroutines.empty() ? 0 : 1), a.subroutines.end(),
+              [](const Subroutine &l, const Subroutine &r) { return l.entry < r.entry; });
+
+    // data: whatever no path reaches.
+    for (unsigned addr = origin; addr < end;) {
+        if (code[addr]) {
+            ++addr;
+            continue;
+        }
+        Region r;
+        r.start = (uint16_t)addr;
+        while (addr < end && !code[addr])
+            ++addr;
+        r.end = (uint16_t)addr;
+        for (unsigned ref : references)
+            r.referenced |= ref >= r.start && ref < r.end;
+        a.data.push_back(r);
+    }
+
+    std::stable_sort(a.findings.begin(), a.findings.end(),
+                     [](const Finding &l, const Finding &r) { return l.address < r.address; });
+    return a;
+}
+
+const RomAnalysis::Block *RomAnalysis::blockAt(const uint16_t start) const
+{
+    auto it = std::lower_bound(blocks.begin(), blocks.end(), start,
+                               [](const Block &b, uint16_t s) { return b.start < s; });
+    return it != blocks.end() && it->start == start ? &*it : nullptr;
+}
+
+std::string RomAnalysis::json() const
+{
+    std::string out = "{\"romSize\":" + std::to_string(romSize) + ",\"instructions\":" + std::to_string(instructions)
+        + ",\"codeBytes\":" + std::to_string(codeBytes) + ",\"subroutines\":[";
+    for (size_t i = 0; i < subroutines.size(); ++i) {
+        const Subroutine &s = subroutines[i];
+        out += (i ? ",{" : "{") + std::string("\"entry\":") + std::to_string(s.entry) + ",\"callers\":[";
+        for (size_t k = 0; k < s.callers.size(); ++k)
+            out += (k ? "," : "") + std::to_string(s.callers[k]);
+        out += std::string("],\"returns\":") + (s.returns ? "true" : "false") + "}";
+    }
+    out += "],\"blocks\":[";
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        const Block &b = blocks[i];
+        out += (i ? ",{" : "{") + std::string("\"start\":") + std::to_string(b.start) + ",\"end\":"
+            + std::to_string(b.end) + ",\"subroutine\":" + std::to_string(b.subroutine) + ",\"exit\":\""
+            + exitName(b.exit) + "\",\"successors\":[";
+        for (size_t k = 0; k < b.successors.size(); ++k)
+            out += (k ? "," : "") + std::to_string(b.successors[k]);
+        out += "],\"code\":[";
+        for (unsigned pc = b.start; pc < b.end; pc += 2)
+            out += (pc != b.start ? "," : "") + quoted(disassemble((memory[pc] << 8) | memory[pc + 1]));
+        out += "]}";
+    }
+    out += "],\"data\":[";
+    for (size_t i = 0; i < data.size(); ++i)
+        out += (i ? ",{" : "{") + std::string("\"start\":") + std::to_string(data[i].start) + ",\"end\":"
+            + std::to_string(data[i].end) + ",\"referenced\":" + (data[i].referenced ? "true" : "false") + "}";
+    out += "],\"findings\":[";
+    for (size_t i = 0; i < findings.size(); ++i) {
+        const Finding &f = findings[i];
+        out += (i ? ",{" : "{") + std::string("\"kind\":\"") + kindName(f.kind) + "\",\"address\":"
+            + std::to_string(f.address) + ",\"opcode\":" + std::to_string(f.opcode) + ",\"detail\":"
+            + quoted(f.detail) + "}";
+    }
+    return out + "]}\n";
+}
+
+std::string RomAnalysis::dot(const std::string &name) const
+{
+    std::string out = "digraph " + quoted(name) + " {\n"
+                      "  node [shape=box, fontname=\"monospace\", fontsize=10];\n";
+    for (const Subroutine &s : subroutines) {
+        out += "  subgraph \"cluster_" + hex(s.entry) + "\" {\n"
+               "    label=\"" + (s.entry == origin ? std::string("main") : "sub " + hex(s.entry)) + "\";\n";
+        for (const Block &b : blocks) {
+            if (b.subroutine != s.entry)
+                continue;
+            std::string label = hex(b.start) + "\\l";
+            for (unsigned pc = b.start; pc < b.end; pc += 2)
+                label += disassemble((memory[pc] << 8) | memory[pc + 1]) + "\\l";
+            out += "    b" + std::to_string(b.start) + " [label=\"" + label + "\""
+                   + (b.exit == Exit::Halt ? ", color=red" : "") + "];\n";
+        }
+        out += "  }\n";
+    }
+    for (const Block &b : blocks) {
+        for (uint16_t next : b.successors) {
+            const char *style = "";
+            if (b.exit == Exit::Call && next != b.end)
+                style = " [style=dashed, label=\"call\"]";
+            else if (b.exit == Exit::Skip && next != b.end)
+                style = " [label=\"skip\"]";
+            else if (b.exit == Exit::Computed)
+                style = " [style=dotted]";
+            out += "  b" + std::to_string(b.start) + " -> b" + std::to_string(next) + style + ";\n";
+        }
+    }
+    return out + "}\n";
+}
@@ -0,0 +1,101 @@
+//
+//  RomAnalyzer.hpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef RomAnalyzer_hpp
+#define RomAnalyzer_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// What a ROM does, found without running it.
+//
+// Starting at 0x200, every instruction execution could reach is decoded:
+// 1nnn and 2nnn are followed to their targets, skips to both the next and
+// the one after, 2nnn also to its return point, and 00EE ends a path. Each
+// call target is a subroutine. The instructions are cut into basic blocks at
+// every target and after every branch, and joined into a control-flow graph
+// that json() and dot() export. Bytes no path reaches are data.
+//
+// Findings are what the interpreter would halt on (isValidOpcode()), paths
+// that leave the ROM, Bnnn jumps (the target depends on V0; a jump table of
+// 1nnn entries at nnn is followed), Fx33/Fx55 writes into code, and
+// instructions that start inside other instructions. I is tracked within a
+// block only: Annn sets it, Fx1E makes it unknown, and a write through an
+// unknown I is reported as such rather than guessed at.
+class RomAnalysis
+{
+public:
+    enum class Exit {
+        FallThrough,    // into the next block, which is a target
+        Jump,           // 1nnn
+        Call,           // 2nnn, then the return point
+        Return,         // 00EE
+        Skip,           // 3xkk, 4xkk, 5xy0, 9xy0, Ex9E, ExA1
+        Computed,       // Bnnn
+        Halt,           // invalid opcode: the interpreter stops here
+        End,            // the next instruction is outside the ROM
+    };
+
+    struct Block {
+        uint16_t start = 0, end = 0;        // [start, end), whole instructions
+        uint16_t subroutine = 0;            // entry of the routine it was first reached from
+        Exit exit = Exit::FallThrough;
+        std::vector<uint16_t> successors;   // block starts; for Call the target, then the return point
+    };
+
+    struct Subroutine {
+        uint16_t entry = 0;
+        std::vector<uint16_t> callers;      // addresses of the 2nnn instructions
+        bool returns = false;               // some block of it ends in 00EE
+    };
+
+    struct Region {
+        uint16_t start = 0, end = 0;        // [start, end)
+        bool referenced = false;            // an Annn points into it (sprites, tables)
+    };
+
+    struct Finding {
+        enum Kind {
+            InvalidOpcode,
+            OutsideRom,         // a jump, call or fall-through leaves the ROM
+            ComputedJump,
+            SelfModification,   // Fx33/Fx55 writes where code is
+            UnresolvedWrite,    // Fx33/Fx55 with I not known here
+            Overlap,            // an instruction starts inside another one
+            MachineCall,        // 0nnn other than 00E0/00EE: ignored by the interpreter
+        } kind;
+        uint16_t address;
+        uint16_t opcode;
+        std::string detail;
+    };
+    static const char *kindName(Finding::Kind);
+    static const char *exitName(Exit);
+
+    // rom is loaded at 0x200, as Emulator::loadBinary() does; larger ROMs are cut.
+    static RomAnalysis analyze(const uint8_t *rom, size_t size);
+
+    std::vector<Block> blocks;              // by address
+    std::vector<Subroutine> subroutines;    // by entry; 0x200 first, with no callers
+    std::vector<Region> data;               // by address
+    std::vector<Finding> findings;          // by address
+    size_t romSize = 0;
+    size_t instructions = 0;
+    size_t codeBytes = 0;
+
+    std::string json() const;
+    // one cluster per subroutine; name labels the graph.
+    std::string dot(const std::string &name) const;
+
+private:
+    std::vector<uint8_t> memory;            // 0x1000, the ROM at 0x200
+
+    const Block *blockAt(uint16_t start) const;
+};
+
+#endif /* RomAnalyzer_hpp */
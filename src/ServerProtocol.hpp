@@ -0,0 +1,104 @@
+//
+//  ServerProtocol.hpp
+//  Chippy
+//
+//  Wire format of the multi-session server (tools/SessionServer.cpp).
+//
+//  Every request and reply is a 16 byte Header followed by `length` payload
+//  bytes. Client and server share a host (Unix domain socket), so all fields
+//  are in host byte order. Requests are answered in order; `tag` is echoed
+//  back so clients can pipeline many requests before reading the replies.
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef ServerProtocol_hpp
+#define ServerProtocol_hpp
+
+#include <cstdint>
+
+#include "Emulator.hpp"
+
+namespace protocol {
+
+const char defaultSocketPath[] = "/tmp/chippy.sock";
+const uint32_t maxPayload = 1 << 20;
+const uint32_t displayBytes = displayHeight * displayWidth / 8;
+
+enum Op : uint8_t {
+    OpCreate = 1,     // payload: CreateRequest + ROM bytes    reply: header.session = new id
+    OpLoad,           // payload: ROM bytes (resets the session first)
+    OpStep,           // payload: StepRequest                  reply: StepReply [+ display if FlagFetchDisplay]
+    OpFetchDisplay,   // reply: displayBytes packed rows, MSB is the leftmost pixel
+    OpSaveState,      // reply: Emulator::State
+    OpRestoreState,   // payload: Emulator::State, checked with Emulator::isValidState()
+    OpStats,          // reply: StatsReply
+    OpDestroy,
+    OpFork            // reply: header.session = id of a copy-on-write clone of the session
+};
+
+enum Flags : uint8_t {
+    FlagFetchDisplay = 1  // OpStep: append the display to the reply, saving a round trip
+};
+
+enum Status : uint8_t {
+    StatusOk = 0,
+    StatusBadRequest,
+    StatusBadSession,
+    StatusLoadFailed
+};
+
+struct Header {
+    uint32_t length;   // payload bytes following the header
+    uint8_t op;
+    uint8_t flags;
+    uint8_t status;    // replies only
+    uint8_t reserved;
+    uint32_t session;
+    uint32_t tag;
+};
+
+// larger requests get StatusBadRequest: one session must not hold up the
+// event loop for the others. A step may run frames * instructionsPerFrame
+// instructions up to maxStepInstructions, a few milliseconds; longer runs
+// take several steps.
+const uint32_t maxStepFrames = 3600;
+const uint32_t maxInstructionsPerFrame = 100000;
+const uint64_t maxStepInstructions = 1000000;
+
+struct CreateRequest {
+    uint32_t seed;
+    uint32_t instructionsPerFrame;  // 0 keeps the emulator default; at most maxInstructionsPerFrame
+};
+
+struct StepRequest {
+    uint32_t frames;                // at most maxStepFrames, and maxStepInstructions in all
+    uint16_t keyMask;
+    uint16_t reserved;
+};
+
+struct StepReply {
+    uint64_t instructions;  // executed by this step
+    uint16_t pc;
+    uint8_t halted;
+    uint8_t waitForKey;
+    uint8_t sound;
+    uint8_t reserved[3];
+};
+
+struct StatsReply {
+    uint64_t frames;
+    uint64_t instructions;
+    uint16_t pc;
+    uint16_t haltOpcode;
+    uint8_t halted;
+    uint8_t waitForKey;
+    uint8_t sound;
+    uint8_t reserved;
+};
+
+static_assert(sizeof(Header) == 16, "protocol header must stay 16 bytes");
+
+} // namespace protocol
+
+#endif /* ServerProtocol_hpp */
@@ -0,0 +1,160 @@
+//
+//  SessionScheduler.cpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include "SessionScheduler.hpp"
+
+#include <cstring>
+
+#include "Debugger.hpp"
+#include "Emulator.hpp"
+
+const char *SessionScheduler::eventName(const Event event)
+{
+    switch (event) {
+        case Event::Frame:        return "frame";
+        case Event::SoundStarted: return "sound started";
+        case Event::SoundStopped: return "sound stopped";
+        case Event::KeyWait:      return "waiting for key";
+        case Event::Idle:         return "idle";
+        case Event::Breakpoint:   return "breakpoint";
+        case Event::Halted:       return "halted";
+    }
+    return "?";
+}
+
+SessionScheduler::Id SessionScheduler::add(Emulator &emulator, Debugger *debugger)
+{
+    Id id;
+    if (!freeIds.empty()) {
+        id = freeIds.back();
+        freeIds.pop_back();
+    }
+    else {
+        id = (Id)sessions.size();
+        sessions.push_back(Session());
+    }
+    Session &s = sessions[id];
+    s.emulator = &emulator;
+    s.debugger = debugger;
+    s.sound = emulator.makeSound();
+    s.runIndex = -1;
+    resume(id);
+    return id;
+}
+
+void SessionScheduler::remove(const Id id)
+{
+    park(id);
+    sessions[id] = Session();
+    freeIds.push_back(id);
+}
+
+void SessionScheduler::pushKeyEvent(const Id id, const uint8_t key, const bool down, const uint64_t timestampNs)
+{
+    sessions[id].emulator->pushKeyEvent(key, down, timestampNs);
+    resume(id);
+}
+
+void SessionScheduler::resume(const Id id)
+{
+    Session &s = sessions[id];
+    if (s.runIndex >= 0 || !s.emulator)
+        return;
+    s.runIndex = (int)runnable.size();
+    runnable.push_back(id);
+}
+
+void SessionScheduler::park(const Id id)
+{
+    Session &s = sessions[id];
+    if (s.runIndex < 0)
+        return;
+    // swap with the last runnable session so parking stays O(1).
+    Id last = runnable.back();
+    runnable[s.runIndex] = last;
+    sessions[last].runIndex = s.runIndex;
+    runnable.pop_back();
+    s.runIndex = -1;
+}
+
+void SessionScheduler::snapshot(const Emulator &emu, Snapshot &s)
+{
+    std::memcpy(s.vReg, emu.vReg, sizeof(s.vReg));
+    std::memcpy(s.stack, emu.stack, sizeof(s.stack));
+    s.pc = emu.pc;
+    s.I = emu.I;
+    s.sp = emu.sp;
+    s.delayTimer = emu.delayTimer;
+    s.soundTimer = emu.soundTimer;
+    s.writes = emu.writes;
+    s.rndGenerator = emu.rndGenerator;
+}
+
+bool SessionScheduler::unchanged(const Emulator &emu, const Snapshot &s)
+{
+    // the key state is the one input not compared; it can only change through pushKeyEvent().
+    return s.pc == emu.pc && s.I == emu.I && s.sp == emu.sp &&
+           s.delayTimer == emu.delayTimer && s.soundTimer == emu.soundTimer &&
+           s.writes == emu.writes && s.rndGenerator == emu.rndGenerator &&
+           std::memcmp(s.vReg, emu.vReg, sizeof(s.vReg)) == 0 &&
+           std::memcmp(s.stack, emu.stack, sizeof(s.stack)) == 0 &&
+           !emu.inputPending();
+}
+
+size_t SessionScheduler::tick(const Handler &handler)
+{
+    ticking = runnable;
+    size_t ran = 0;
+    Snapshot before;
+    for (Id id : ticking) {
+        // an earlier handler may have parked or removed it.
+        if (sessions[id].runIndex < 0)
+            continue;
+        Emulator &emu = *sessions[id].emulator;
+        Debugger *debugger = sessions[id].debugger;
+
+        snapshot(emu, before);
+        Debugger::Stop stop = Debugger::Stop::None;
+        if (debugger)
+            stop = debugger->runFrame(emu);
+        else
+            emu.runFrame();
+        ++ran;
+
+        bool sound = emu.makeSound();
+        if (sound != sessions[id].sound) {
+            sessions[id].sound = sound;
+            if (handler)
+                handler(id, sound ? Event::SoundStarted : Event::SoundStopped);
+        }
+        // a debugger stop ends the frame early; it did not complete.
+        bool stopped = stop != Debugger::Stop::None && stop != Debugger::Stop::Halted;
+        if (!stopped && handler)
+            handler(id, Event::Frame);
+
+        // the handlers may have removed the session or queued keys for it.
+        if (sessions[id].emulator != &emu || emu.inputPending())
+            continue;
+        Event parked;
+        if (emu.halted)
+            parked = Event::Halted;
+        else if (stopped)
+            parked = Event::Breakpoint;
+        // under a cycleModel the timers still count down once per frame in
+        // Fx0A (beep, then wait for a key), so it parks once they are done.
+        else if (emu.waitForKey && (!emu.cycleModel || (!emu.delayTimer && !emu.soundTimer)))
+            parked = Event::KeyWait;
+        else if (unchanged(emu, before))
+            parked = Event::Idle;
+        else
+            continue;
+        park(id);
+        if (handler)
+            handler(id, parked);
+    }
+    return ran;
+}
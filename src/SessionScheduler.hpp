@@ -0,0 +1,98 @@
+//
+//  SessionScheduler.hpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef SessionScheduler_hpp
+#define SessionScheduler_hpp
+
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <vector>
+
+class Debugger;
+class Emulator;
+
+// Hosts many emulators on one thread.
+//
+// Each session is resumable: tick() resumes every runnable session for one
+// frame and reports what happened (frame complete, sound on/off) and why it
+// stopped, if it did. A session that stops is parked and costs nothing until
+// something can change its outcome:
+//   - KeyWait: Fx0A is waiting; pushKeyEvent() resumes it.
+//   - Idle: the frame left the machine exactly as it found it (no display or
+//     memory writes, same registers, timers, stack and random state), so every
+//     further frame would too until a key changes; pushKeyEvent() resumes it.
+//     This catches key polling loops and jumps to self whose length divides
+//     instructionsPerFrame.
+//   - Breakpoint: the session's Debugger stopped; resume() continues.
+//   - Halted: invalid opcode or stack fault; resume() after fixing it up.
+// Parked sessions are not visited by tick() at all.
+class SessionScheduler
+{
+public:
+    typedef uint32_t Id;     // reused after remove()
+
+    enum class Event {
+        Frame,          // a frame completed
+        SoundStarted,
+        SoundStopped,
+        KeyWait,        // parked
+        Idle,           // parked
+        Breakpoint,     // parked; Debugger::lastStopAddress() says where
+        Halted          // parked
+    };
+    static const char *eventName(Event);
+
+    typedef std::function<void(Id, Event)> Handler;
+
+    // the emulator (and debugger, if any) stay owned by the caller and must
+    // outlive the session; with a debugger, frames go through Debugger::runFrame().
+    Id add(Emulator&, Debugger *debugger = nullptr);
+    void remove(Id);
+
+    // queues the event on the session's emulator and resumes it if parked.
+    void pushKeyEvent(Id, uint8_t key, bool down, uint64_t timestampNs = 0);
+    // makes a parked session runnable again, e.g. after a breakpoint.
+    void resume(Id);
+    bool isRunnable(Id id) const { return sessions[id].runIndex >= 0; }
+    Emulator &emulator(Id id) const { return *sessions[id].emulator; }
+
+    size_t size() const { return sessions.size() - freeIds.size(); }
+    size_t runnableCount() const { return runnable.size(); }
+
+    // resumes each runnable session for one frame, in turn; returns how many ran.
+    size_t tick(const Handler&);
+
+private:
+    struct Snapshot {
+        uint8_t vReg[16];
+        uint16_t stack[16];
+        uint16_t pc, I;
+        int8_t sp;
+        uint8_t delayTimer, soundTimer;
+        uint32_t writes;
+        std::minstd_rand rndGenerator;
+    };
+
+    struct Session {
+        Emulator *emulator = nullptr;
+        Debugger *debugger = nullptr;
+        int runIndex = -1;      // position in runnable, -1 while parked or free
+        bool sound = false;
+    };
+
+    std::vector<Session> sessions;
+    std::vector<Id> freeIds;
+    std::vector<Id> runnable;
+    std::vector<Id> ticking;    // this tick's copy of runnable, which handlers may change
+
+    void park(Id);
+    static void snapshot(const Emulator&, Snapshot&);
+    static bool unchanged(const Emulator&, const Snapshot&);
+};
+
+#endif /* SessionScheduler_hpp */
@@ -0,0 +1,140 @@
+//
+//  SessionWall.cpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include "SessionWall.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "SessionScheduler.hpp"
+
+struct SessionWall::Worker {
+    std::thread thread;
+    int first, last;                // sessions [first, last)
+    std::vector<uint64_t> packed;   // this frame's changed displays, before publishing
+    std::vector<int> changed;
+};
+
+SessionWall::SessionWall()
+{
+}
+
+SessionWall::~SessionWall()
+{
+    stop();
+}
+
+void SessionWall::start(const Emulator &source, const int count, int threads, const double frameRate)
+{
+    stop();
+    this->count = count;
+    // the source keeps running on its own thread; only boot is shared with the workers.
+    boot.cloneFrom(source);
+    boot.instructionsPerFrame = source.instructionsPerFrame;
+    sessions.clear();
+    for (int i = 0; i < count; ++i) {
+        sessions.emplace_back(new Emulator);
+        Emulator &e = *sessions.back();
+        e.instructionsPerFrame = boot.instructionsPerFrame;
+        e.cloneFrom(boot);
+        e.seedRandom(i + 1);
+    }
+    published.assign((size_t)count * displayHeight, 0);
+    dirty.assign(count, 1);
+    dirtyCount = count;
+    for (int i = 0; i < count; ++i)
+        sessions[i]->packDisplay(&published[(size_t)i * displayHeight]);
+
+    if (threads <= 0)
+        threads = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+    threads = std::min(threads, std::max(1, count));
+    stopping = false;
+    for (int t = 0; t < threads; ++t) {
+        std::unique_ptr<Worker> w(new Worker);
+        w->first = (int)((int64_t)count * t / threads);
+        w->last = (int)((int64_t)count * (t + 1) / threads);
+        workers.push_back(std::move(w));
+    }
+    for (auto &w : workers)
+        w->thread = std::thread(&SessionWall::run, this, std::ref(*w), frameRate);
+}
+
+void SessionWall::stop()
+{
+    stopping = true;
+    for (auto &w : workers)
+        w->thread.join();
+    workers.clear();
+}
+
+void SessionWall::run(Worker &w, const double frameRate)
+{
+    SessionScheduler scheduler;
+    std::vector<int> sessionOf;
+    for (int i = w.first; i < w.last; ++i) {
+        SessionScheduler::Id id = scheduler.add(*sessions[i]);
+        sessionOf.resize(std::max<size_t>(sessionOf.size(), id + 1));
+        sessionOf[id] = i;
+    }
+
+    auto onEvent = [&](SessionScheduler::Id id, SessionScheduler::Event event) {
+        Emulator &e = scheduler.emulator(id);
+        if (event != SessionScheduler::Event::Frame || !e.drawDisplay)
+            return;
+        e.drawDisplay = false;
+        w.changed.push_back(sessionOf[id]);
+        w.packed.resize(w.changed.size() * displayHeight);
+        e.packDisplay(&w.packed[(w.changed.size() - 1) * displayHeight]);
+    };
+
+    typedef std::chrono::steady_clock Clock;
+    const auto frameTime = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / frameRate));
+    auto deadline = Clock::now();
+    while (!stopping) {
+        w.changed.clear();
+        scheduler.tick(onEvent);
+
+        if (!w.changed.empty()) {
+            std::lock_guard<std::mutex> lock(publishMutex);
+            for (size_t i = 0; i < w.changed.size(); ++i) {
+                int s = w.changed[i];
+                std::memcpy(&published[(size_t)s * displayHeight], &w.packed[i * displayHeight], displayHeight * sizeof(uint64_t));
+                if (!dirty[s]) {
+                    dirty[s] = 1;
+                    ++dirtyCount;
+                }
+            }
+        }
+
+        // behind by more than a few frames (e.g. too many sessions): drop them rather than spin.
+        deadline += frameTime;
+        auto now = Clock::now();
+        if (now - deadline > frameTime * 4)
+            deadline = now;
+        std::this_thread::sleep_until(deadline);
+    }
+}
+
+int SessionWall::collect(std::vector<uint64_t> &packed, std::vector<uint8_t> &changed)
+{
+    packed.resize(published.size());
+    changed.assign(count, 0);
+    std::lock_guard<std::mutex> lock(publishMutex);
+    if (!dirtyCount)
+        return 0;
+    int n = dirtyCount;
+    for (int s = 0; s < count; ++s) {
+        if (!dirty[s])
+            continue;
+        std::memcpy(&packed[(size_t)s * displayHeight], &published[(size_t)s * displayHeight], displayHeight * sizeof(uint64_t));
+        changed[s] = 1;
+        dirty[s] = 0;
+    }
+    dirtyCount = 0;
+    return n;
+}
@@ -0,0 +1,62 @@
+//
+//  SessionWall.hpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef SessionWall_hpp
+#define SessionWall_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Emulator.hpp"
+
+// Runs a batch of sessions off the render thread for monitoring, e.g. by an
+// AtlasView.
+//
+// Every session is a copy-on-write clone of one source emulator, seeded
+// differently so they diverge. Worker threads each own a slice of them and
+// run it at frameRate through a SessionScheduler, so sessions that wait for
+// a key or sit idle cost nothing. After every frame a worker publishes the
+// displays that changed; collect() hands them to the render thread.
+class SessionWall
+{
+public:
+    SessionWall();
+    ~SessionWall();
+
+    // threads = 0: one per core, leaving one for the render thread.
+    void start(const Emulator &source, int count, int threads = 0, double frameRate = 60);
+    void stop();
+    bool running() const { return !workers.empty(); }
+    int size() const { return count; }
+
+    // copies the packed displays (Emulator::packDisplay, displayHeight rows each)
+    // of sessions that changed since the last call into packed[session * displayHeight]
+    // and sets changed[session]; returns how many changed. Both are resized to fit.
+    int collect(std::vector<uint64_t> &packed, std::vector<uint8_t> &changed);
+
+private:
+    struct Worker;
+
+    int count = 0;
+    Emulator boot;      // the pages every session shares until it writes them
+    std::vector<std::unique_ptr<Emulator>> sessions;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<bool> stopping { false };
+
+    std::mutex publishMutex;
+    std::vector<uint64_t> published;
+    std::vector<uint8_t> dirty;
+    int dirtyCount = 0;
+
+    void run(Worker&, double frameRate);
+};
+
+#endif /* SessionWall_hpp */
@@ -0,0 +1,108 @@
+//
+//  StatePublisher.cpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include "StatePublisher.hpp"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+bool LiveState::read(const LiveState &shared, LiveState &copy, const int attempts)
+{
+    for (int i = 0; i < attempts; ++i) {
+        uint32_t before = shared.sequence.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+        // the atomic member is copied along with the rest; only its value is checked.
+        std::memcpy((void *)&copy, (const void *)&shared, sizeof(LiveState));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (shared.sequence.load(std::memory_order_relaxed) == before)
+            return true;
+    }
+    return false;
+}
+
+StatePublisher::~StatePublisher()
+{
+    close();
+}
+
+bool StatePublisher::open(const std::string &name)
+{
+    close();
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+        return false;
+    if (ftruncate(fd, sizeof(LiveState)) != 0) {
+        ::close(fd);
+        return false;
+    }
+    void *p = mmap(nullptr, sizeof(LiveState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        return false;
+
+    state = static_cast<LiveState *>(p);
+    this->name = name;
+    // readers check the magic before trusting anything else; write it last.
+    state->sequence.store(0, std::memory_order_relaxed);
+    state->version = LiveState::currentVersion;
+    state->writerPid = (uint32_t)getpid();
+    std::atomic_thread_fence(std::memory_order_release);
+    state->magic = LiveState::magicValue;
+    published = 0;
+    countdown = 0;
+    return true;
+}
+
+void StatePublisher::close()
+{
+    if (!state)
+        return;
+    munmap(state, sizeof(LiveState));
+    shm_unlink(name.c_str());
+    state = nullptr;
+}
+
+void StatePublisher::frameComplete(const Emulator &emulator)
+{
+    if (--countdown > 0)
+        return;
+    countdown = interval;
+    publish(emulator);
+}
+
+void StatePublisher::publish(const Emulator &emu)
+{
+    if (!state)
+        return;
+    uint32_t seq = state->sequence.load(std::memory_order_relaxed);
+    state->sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    state->timestampNs = Emulator::timestampNow();
+    state->frames = ++published;
+    state->totalInstructions = emu.statTotalInstructions;
+    emu.packDisplay(state->display);
+    state->pc = emu.pc;
+    state->I = emu.I;
+    std::memcpy(state->stack, emu.stack, sizeof(state->stack));
+    state->haltOpcode = emu.haltOpcode;
+    state->keys = emu.getKeyMask();
+    std::memcpy(state->vReg, emu.vReg, sizeof(state->vReg));
+    state->sp = emu.sp;
+    state->delayTimer = emu.delayTimer;
+    state->soundTimer = emu.soundTimer;
+    state->waitForKey = emu.waitForKey;
+    state->halted = emu.halted;
+    for (int p = 0; p < Emulator::pageCount; ++p)
+        std::memcpy(state->memory + p * Emulator::pageSize, emu.pagePtr[p], Emulator::pageSize);
+
+    state->sequence.store(seq + 2, std::memory_order_release);
+}
@@ -0,0 +1,84 @@
+//
+//  StatePublisher.hpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef StatePublisher_hpp
+#define StatePublisher_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "Emulator.hpp"
+
+// The layout of a live state segment, shared by writer and readers.
+//
+// sequence is a seqlock: odd while the writer is inside, bumped by two per
+// snapshot. Readers copy the whole struct and keep the copy only if sequence
+// was even and the same before and after (LiveState::read()), so they never
+// block the writer and never see a torn snapshot.
+struct LiveState {
+    enum { magicValue = 0x56384C43, currentVersion = 1 };  // "C8LV"
+
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint32_t> sequence;
+    uint32_t writerPid;
+
+    uint64_t timestampNs;           // Emulator::timestampNow() at publish
+    uint64_t frames;                // published snapshots so far
+    uint64_t totalInstructions;     // Emulator::statTotalInstructions
+    uint64_t display[displayHeight];// Emulator::packDisplay() rows
+
+    uint16_t pc, I;
+    uint16_t stack[16];
+    uint16_t haltOpcode;
+    uint16_t keys;                  // Emulator::getKeyMask()
+    uint8_t vReg[16];
+    int8_t sp;
+    uint8_t delayTimer, soundTimer;
+    uint8_t waitForKey, halted;
+    uint8_t reserved[3];
+
+    uint8_t memory[0x1000];
+
+    // copies a consistent snapshot out of a mapped segment; false if the writer
+    // stayed busy for all attempts.
+    static bool read(const LiveState &shared, LiveState &copy, int attempts = 1000);
+};
+
+// Publishes an emulator's state into a POSIX shared-memory segment for
+// external viewers, memory editors and metrics scrapers.
+//
+// Attach as the emulator's frameSink (or call publish() yourself). Each
+// snapshot is a few plain copies into the mapping, about as much work as one
+// frame of a simple program, and never waits for readers; use setInterval()
+// to publish every Nth frame when fast-forwarding.
+class StatePublisher : public FrameSink
+{
+public:
+    ~StatePublisher();
+
+    // name as for shm_open(), e.g. "/chippy"; an existing segment is reused.
+    bool open(const std::string &name);
+    void close();
+    bool isOpen() const { return state != nullptr; }
+    const std::string &getName() const { return name; }
+
+    void setInterval(int frames) { interval = frames < 1 ? 1 : frames; }
+
+    void frameComplete(const Emulator&) override;
+    void publish(const Emulator&);
+
+private:
+    std::string name;
+    LiveState *state = nullptr;
+    int interval = 1;
+    int countdown = 0;
+    uint64_t published = 0;
+};
+
+#endif /* StatePublisher_hpp */
@@ -0,0 +1,109 @@
+//
+//  TerminalRenderer.cpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include "TerminalRenderer.hpp"
+
+#include <cstdio>
+
+namespace {
+
+// UTF-8 for ' ', U+2580 upper half, U+2584 lower half and U+2588 full block, by (bottom << 1 | top).
+const char *halfBlocks[4] = { " ", "\xE2\x96\x80", "\xE2\x96\x84", "\xE2\x96\x88" };
+
+inline int pixel(const uint64_t packed[displayHeight], int x, int y)
+{
+    return (packed[y] >> (displayWidth - 1 - x)) & 1;
+}
+
+void appendUtf8(std::string &out, uint32_t cp)
+{
+    // only ever called for U+2800..U+28FF.
+    out += (char)(0xE0 | (cp >> 12));
+    out += (char)(0x80 | ((cp >> 6) & 0x3F));
+    out += (char)(0x80 | (cp & 0x3F));
+}
+
+void appendMoveTo(std::string &out, int row, int column)
+{
+    char buf[24];
+    int n = std::snprintf(buf, sizeof(buf), "\x1b[%d;%dH", row, column);
+    out.append(buf, n);
+}
+
+} // namespace
+
+TerminalRenderer::TerminalRenderer(const Mode mode, const int top, const int left)
+    : mode(mode), top(top), left(left)
+{
+}
+
+void TerminalRenderer::appendCell(std::string &out, const uint64_t packed[displayHeight], const int cx, const int cy) const
+{
+    if (mode == Mode::HalfBlock) {
+        out += halfBlocks[pixel(packed, cx, cy * 2) | (pixel(packed, cx, cy * 2 + 1) << 1)];
+        return;
+    }
+    // braille dot numbering: the left column is dots 1,2,3,7 and the right 4,5,6,8.
+    static const uint8_t dots[4][2] = { { 0x01, 0x08 }, { 0x02, 0x10 }, { 0x04, 0x20 }, { 0x40, 0x80 } };
+    uint32_t bits = 0;
+    for (int y = 0; y < 4; ++y)
+        for (int x = 0; x < 2; ++x)
+            if (pixel(packed, cx * 2 + x, cy * 4 + y))
+                bits |= dots[y][x];
+    appendUtf8(out, 0x2800 + bits);
+}
+
+void TerminalRenderer::render(const Emulator &emulator, std::string &out)
+{
+    uint64_t packed[displayHeight];
+    emulator.packDisplay(packed);
+
+    const int cellHeight = mode == Mode::HalfBlock ? 2 : 4;
+    const int cellWidth = mode == Mode::HalfBlock ? 1 : 2;
+    for (int cy = 0; cy < rows(); ++cy) {
+        // pixels that differ from the last frame anywhere in this row of cells.
+        uint64_t changed = valid ? 0 : ~0ULL;
+        for (int y = cy * cellHeight; y < (cy + 1) * cellHeight; ++y)
+            changed |= packed[y] ^ previous[y];
+        if (!changed)
+            continue;
+
+        int cursor = -1; // column the terminal cursor is at after our last write
+        for (int cx = 0; cx < columns(); ++cx) {
+            uint64_t mask = (cellWidth == 1 ? 1ULL : 3ULL) << (displayWidth - cellWidth - cx * cellWidth);
+            if (!(changed & mask))
+                continue;
+            if (cursor != cx)
+                appendMoveTo(out, top + cy, left + cx);
+            appendCell(out, packed, cx, cy);
+            cursor = cx + 1;
+        }
+    }
+
+    for (int y = 0; y < displayHeight; ++y)
+        previous[y] = packed[y];
+    valid = true;
+}
+
+std::string TerminalRenderer::plainText(const Emulator &emulator)
+{
+    uint64_t packed[displayHeight];
+    emulator.packDisplay(packed);
+    return plainText(packed);
+}
+
+std::string TerminalRenderer::plainText(const uint64_t packed[displayHeight])
+{
+    std::string out;
+    out.reserve((displayWidth * 3 + 1) * displayHeight / 2);
+    for (int y = 0; y < displayHeight; y += 2) {
+        for (int x = 0; x < displayWidth; ++x)
+            out += halfBlocks[pixel(packed, x, y) | (pixel(packed, x, y + 1) << 1)];
+        out += '\n';
+    }
+    return out;
+}
@@ -0,0 +1,52 @@
+//
+//  TerminalRenderer.hpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef TerminalRenderer_hpp
+#define TerminalRenderer_hpp
+
+#include <cstdint>
+#include <string>
+
+#include "Emulator.hpp"
+
+// Draws the display on an ANSI/UTF-8 terminal.
+//
+// Pixels are packed several to a character cell: half blocks (1x2, a 64x16
+// cell screen) or braille (2x4, 32x8 cells). The previous frame is kept as
+// packed rows, and render() only emits the cells that changed, each run of
+// them preceded by one cursor-addressing escape, so an idle screen costs
+// nothing and a moving sprite a few dozen bytes.
+class TerminalRenderer
+{
+public:
+    enum class Mode { HalfBlock, Braille };
+
+    // top/left: 1-based terminal position of the first cell.
+    explicit TerminalRenderer(Mode mode = Mode::HalfBlock, int top = 1, int left = 1);
+
+    // appends what brings the terminal from the last rendered frame to this one.
+    // The first call after construction or invalidate() redraws every cell.
+    void render(const Emulator&, std::string &out);
+    void invalidate() { valid = false; }
+
+    int columns() const { return mode == Mode::HalfBlock ? displayWidth : displayWidth / 2; }
+    int rows() const { return mode == Mode::HalfBlock ? displayHeight / 2 : displayHeight / 4; }
+
+    // the whole display as half-block lines, without escapes (logs, consoles).
+    static std::string plainText(const Emulator&);
+    static std::string plainText(const uint64_t packed[displayHeight]);
+
+private:
+    Mode mode;
+    int top, left;
+    uint64_t previous[displayHeight];
+    bool valid = false;
+
+    void appendCell(std::string &out, const uint64_t packed[displayHeight], int cx, int cy) const;
+};
+
+#endif /* TerminalRenderer_hpp */
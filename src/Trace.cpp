@@ -0,0 +1,54 @@
+//
+//  Trace.cpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+const char TraceBuffer::fileMagic[8] = { 'C', '8', 'T', 'R', 'A', 'C', 'E', '1' };
+
+TraceBuffer::TraceBuffer(size_t capacityLog2)
+    : records(size_t(1) << capacityLog2), mask((uint64_t(1) << capacityLog2) - 1)
+{
+}
+
+std::vector<TraceRecord> TraceBuffer::snapshot() const
+{
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t begin = end > records.size() ? end - records.size() : 0;
+    std::vector<TraceRecord> out;
+    out.reserve(end - begin);
+    for (uint64_t i = begin; i < end; ++i)
+        out.push_back(records[i & mask]);
+
+    // anything the producer lapped while we were copying is torn; drop it.
+    // The fence keeps the copies above from moving below the second load, and
+    // slot now & mask (record now - size) may be mid-write, so it goes too.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t now = head.load(std::memory_order_relaxed);
+    if (now + 1 > records.size() + begin) {
+        size_t lost = std::min<uint64_t>(out.size(), now + 1 - records.size() - begin);
+        out.erase(out.begin(), out.begin() + lost);
+    }
+    return out;
+}
+
+bool TraceBuffer::dump(const std::string &path) const
+{
+    auto out = snapshot();
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (!fp)
+        return false;
+    uint32_t recordSize = sizeof(TraceRecord);
+    uint64_t count = out.size();
+    bool ok = fwrite(fileMagic, sizeof(fileMagic), 1, fp) == 1
+           && fwrite(&recordSize, sizeof(recordSize), 1, fp) == 1
+           && fwrite(&count, sizeof(count), 1, fp) == 1
+           && (out.empty() || fwrite(out.data(), sizeof(TraceRecord), out.size(), fp) == out.size());
+    return fclose(fp) == 0 && ok;
+}
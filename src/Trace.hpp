@@ -0,0 +1,78 @@
+//
+//  Trace.hpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef Trace_hpp
+#define Trace_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One executed instruction. `reg`/`value` are Vx and its value after the
+// instruction; whether the instruction actually wrote Vx follows from the
+// opcode, which the decoder (tools/TraceDump.cpp) works out.
+struct TraceRecord {
+    uint32_t cycle;      // low 32 bits of the instruction number; the decoder unwraps it
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t I;
+    uint8_t reg;
+    uint8_t value;
+    uint8_t vf;
+    uint8_t flags;       // traceFlag* below
+    uint16_t reserved;
+};
+
+static_assert(sizeof(TraceRecord) == 16, "trace records are written to disk as-is");
+
+enum : uint8_t {
+    traceFlagHalted = 1    // the instruction halted the interpreter (invalid opcode, stack fault)
+};
+
+// Lock-free single-producer ring of TraceRecords.
+//
+// The emulation thread appends with a plain store and one release store of
+// the head; any thread may snapshot or dump concurrently and simply loses
+// records the producer overwrote meanwhile. Recording can be limited to a
+// window of instruction numbers.
+class TraceBuffer
+{
+public:
+    static const char fileMagic[8];
+
+    explicit TraceBuffer(size_t capacityLog2 = 20);
+
+    void setWindow(uint64_t firstCycle, uint64_t cycles) { windowStart = firstCycle; windowLength = cycles; }
+    void clearWindow() { windowStart = 0; windowLength = UINT64_MAX; }
+
+    void append(uint64_t cycle, const TraceRecord &r)
+    {
+        if (cycle - windowStart >= windowLength)
+            return;
+        uint64_t h = head.load(std::memory_order_relaxed);
+        records[h & mask] = r;
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    void clear() { head.store(0, std::memory_order_release); }
+    uint64_t recorded() const { return head.load(std::memory_order_acquire); }
+    size_t capacity() const { return records.size(); }
+
+    // oldest-first copy of what is currently in the ring.
+    std::vector<TraceRecord> snapshot() const;
+    bool dump(const std::string &path) const;
+
+private:
+    std::vector<TraceRecord> records;
+    uint64_t mask;
+    std::atomic<uint64_t> head {0};
+    uint64_t windowStart = 0;
+    uint64_t windowLength = UINT64_MAX;
+};
+
+#endif /* Trace_hpp */
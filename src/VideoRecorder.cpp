@@ -0,0 +1,205 @@
+//
+//  VideoRecorder.cpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include "VideoRecorder.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+const size_t writerBatch = 256;
+const size_t fileBufferSize = 16 * 1024;
+const size_t lumaFrameSize = displayHeight * displayWidth;
+}
+
+void VideoRecorder::Stream::frameComplete(const Emulator& emulator)
+{
+    uint64_t rows[displayHeight];
+    emulator.packDisplay(rows);
+    pushFrame(rows);
+}
+
+void VideoRecorder::Stream::pushFrame(const uint64_t rows[displayHeight])
+{
+    if (!closed)
+        recorder->enqueue(id, false, rows);
+}
+
+void VideoRecorder::Stream::pushLuma(const uint8_t *luma)
+{
+    if (!closed)
+        recorder->enqueue(id, false, nullptr, luma);
+}
+
+void VideoRecorder::Stream::close()
+{
+    if (closed)
+        return;
+    closed = true;
+    recorder->enqueue(id, true, nullptr);
+}
+
+VideoRecorder::VideoRecorder(size_t queueFrames, bool dropWhenFull)
+    : queue(std::max<size_t>(queueFrames, 1)), dropWhenFull(dropWhenFull)
+{
+    writer = std::thread(&VideoRecorder::writerLoop, this);
+}
+
+VideoRecorder::~VideoRecorder()
+{
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueNotEmpty.notify_one();
+    writer.join();
+    for (auto &f : files)
+        if (f->fp)
+            fclose(f->fp);
+}
+
+VideoRecorder::Stream *VideoRecorder::open(const std::string &path, Format format)
+{
+    std::unique_ptr<File> file(new File);
+    file->fp = fopen(path.c_str(), "wb");
+    if (!file->fp)
+        return nullptr;
+    file->format = format;
+    file->buffer.resize(fileBufferSize);
+    setvbuf(file->fp, file->buffer.data(), _IOFBF, file->buffer.size());
+    if (format == Format::Y4M)
+        fprintf(file->fp, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 Cmono\n", displayWidth, displayHeight);
+    else
+        fprintf(file->fp, "CHIPVID1");
+
+    std::lock_guard<std::mutex> lock(streamsMutex);
+    if (!freeIds.empty()) {
+        // nothing for this id is queued any more; its stream starts over.
+        uint32_t id = freeIds.back();
+        freeIds.pop_back();
+        files[id] = std::move(file);
+        streams[id]->closed = false;
+        return streams[id].get();
+    }
+    uint32_t id = (uint32_t)streams.size();
+    files.push_back(std::move(file));
+    streams.push_back(std::unique_ptr<Stream>(new Stream(this, id)));
+    return streams.back().get();
+}
+
+void VideoRecorder::enqueue(uint32_t stream, bool close, const uint64_t *rows, const uint8_t *luma)
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    if (count == queue.size()) {
+        if (!close && dropWhenFull) {
+            ++statFramesDropped;
+            return;
+        }
+        // a close must not be lost; it is rare enough to wait for room.
+        queueNotFull.wait(lock, [this] { return count < queue.size(); });
+    }
+    size_t slot = (head + count) % queue.size();
+    Entry &e = queue[slot];
+    e.stream = stream;
+    e.close = close;
+    e.shaded = luma != nullptr;
+    if (rows)
+        std::memcpy(e.rows, rows, sizeof(e.rows));
+    if (luma) {
+        if (lumaSlots.empty())
+            lumaSlots.resize(queue.size() * lumaFrameSize);
+        std::memcpy(&lumaSlots[slot * lumaFrameSize], luma, lumaFrameSize);
+    }
+    bool wasEmpty = (count++ == 0);
+    lock.unlock();
+    if (wasEmpty)
+        queueNotEmpty.notify_one();
+}
+
+void VideoRecorder::writerLoop()
+{
+    std::vector<Entry> batch;
+    std::vector<uint8_t> batchLuma;
+    batch.reserve(writerBatch);
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueNotEmpty.wait(lock, [this] { return count > 0 || stopping; });
+            if (count == 0 && stopping)
+                return;
+            size_t n = std::min(count, writerBatch);
+            for (size_t i = 0; i < n; ++i) {
+                size_t slot = (head + i) % queue.size();
+                batch.push_back(queue[slot]);
+                // the slot is reused as soon as the lock is released, so shaded frames are copied out too.
+                if (queue[slot].shaded) {
+                    if (batchLuma.empty())
+                        batchLuma.resize(writerBatch * lumaFrameSize);
+                    std::memcpy(&batchLuma[i * lumaFrameSize], &lumaSlots[slot * lumaFrameSize], lumaFrameSize);
+                }
+            }
+            head = (head + n) % queue.size();
+            count -= n;
+        }
+        queueNotFull.notify_all();
+        for (size_t i = 0; i < batch.size(); ++i)
+            writeEntry(batch[i], batch[i].shaded ? &batchLuma[i * lumaFrameSize] : nullptr);
+        batch.clear();
+    }
+}
+
+void VideoRecorder::writeEntry(const Entry& e, const uint8_t *shade)
+{
+    File *file;
+    {
+        std::lock_guard<std::mutex> lock(streamsMutex);
+        file = files[e.stream].get();
+    }
+    if (!file->fp)
+        return;
+    if (e.close) {
+        fclose(file->fp);
+        file->fp = nullptr;
+        std::vector<char>().swap(file->buffer);
+        std::lock_guard<std::mutex> lock(streamsMutex);
+        freeIds.push_back(e.stream);
+        return;
+    }
+
+    if (file->format == Format::Y4M) {
+        static const char frameTag[] = "FRAME\n";
+        uint8_t luma[displayHeight * displayWidth];
+        uint8_t *p = luma;
+        if (shade) {
+            for (size_t i = 0; i < lumaFrameSize; ++i)
+                *(p++) = 16 + shade[i] * 219 / 255;
+        }
+        else {
+            for (int y = 0; y < displayHeight; ++y)
+                for (int x = displayWidth - 1; x >= 0; --x)
+                    *(p++) = ((e.rows[y] >> x) & 1) ? 235 : 16; // video range black/white
+        }
+        fwrite(frameTag, 1, sizeof(frameTag) - 1, file->fp);
+        fwrite(luma, 1, sizeof(luma), file->fp);
+    }
+    else {
+        uint8_t packed[displayHeight * 8];
+        if (shade) {
+            std::memset(packed, 0, sizeof(packed));
+            for (size_t i = 0; i < lumaFrameSize; ++i)
+                if (shade[i] >= 128)
+                    packed[i / 8] |= 0x80 >> (i % 8);
+        }
+        else {
+            for (int y = 0; y < displayHeight; ++y)
+                for (int b = 0; b < 8; ++b)
+                    packed[y * 8 + b] = (e.rows[y] >> (56 - b * 8)) & 0xFF;
+        }
+        fwrite(packed, 1, sizeof(packed), file->fp);
+    }
+    ++statFramesWritten;
+}
@@ -0,0 +1,106 @@
+//
+//  VideoRecorder.hpp
+//  Chippy
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#ifndef VideoRecorder_hpp
+#define VideoRecorder_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Emulator.hpp"
+
+// Streams emulator frames to disk from one background writer thread.
+//
+// Emulation threads only pack the display (256 bytes) into a bounded queue;
+// expanding and writing happens on the writer thread. When the queue is full
+// the frame is dropped and counted rather than blocking the emulator, unless
+// the recorder was created with dropWhenFull = false (offline batch runs that
+// outpace the disk). One recorder can serve thousands of streams.
+class VideoRecorder
+{
+public:
+    enum class Format {
+        Y4M,    // YUV4MPEG2, 8-bit monochrome, 64x32 @ 60 fps (ffmpeg/mpv readable)
+        Packed  // "CHIPVID1" header followed by 32 big-endian 64-bit rows per frame
+    };
+
+    class Stream : public FrameSink
+    {
+    public:
+        void frameComplete(const Emulator&) override;
+        void pushFrame(const uint64_t rows[displayHeight]);
+        // a shaded frame, [displayHeight][displayWidth] 0..255 (e.g. Phosphor::pixels());
+        // Packed streams store it thresholded at half brightness.
+        void pushLuma(const uint8_t *luma);
+        void close();
+
+    private:
+        friend class VideoRecorder;
+        Stream(VideoRecorder *recorder, uint32_t id) : recorder(recorder), id(id) {}
+
+        VideoRecorder *recorder;
+        uint32_t id;
+        bool closed = false;
+    };
+
+    explicit VideoRecorder(size_t queueFrames = 8192, bool dropWhenFull = true);
+    ~VideoRecorder();
+
+    // returns nullptr if the file cannot be created. The recorder owns the stream;
+    // once closed it may be handed out again by a later open(), so it is not to be
+    // used after close(). Memory stays bounded by the streams open at once.
+    Stream *open(const std::string &path, Format format = Format::Y4M);
+
+    uint64_t framesWritten() const { return statFramesWritten; }
+    uint64_t framesDropped() const { return statFramesDropped; }
+
+private:
+    struct Entry {
+        uint32_t stream;
+        bool close;
+        bool shaded;    // the frame is in lumaSlots at this entry's index, not rows
+        uint64_t rows[displayHeight];
+    };
+
+    struct File {
+        FILE *fp = nullptr;
+        Format format = Format::Y4M;
+        std::vector<char> buffer;
+    };
+
+    std::vector<Entry> queue;
+    std::vector<uint8_t> lumaSlots;     // one frame per queue entry, allocated on first pushLuma()
+    size_t head = 0, count = 0;
+    std::mutex queueMutex;
+    std::condition_variable queueNotEmpty;
+    std::condition_variable queueNotFull;
+    bool dropWhenFull;
+    bool stopping = false;
+
+    std::mutex streamsMutex;
+    std::vector<std::unique_ptr<Stream>> streams;
+    std::vector<std::unique_ptr<File>> files;
+    std::vector<uint32_t> freeIds;      // streams whose close the writer has done
+
+    std::atomic<uint64_t> statFramesWritten {0};
+    std::atomic<uint64_t> statFramesDropped {0};
+
+    std::thread writer;
+
+    void enqueue(uint32_t stream, bool close, const uint64_t *rows, const uint8_t *luma = nullptr);
+    void writerLoop();
+    void writeEntry(const Entry&, const uint8_t *luma);
+};
+
+#endif /* VideoRecorder_hpp */
@@ -0,0 +1,234 @@
+//
+//  ChippyAnalyze.cpp
+//  Chippy
+//
+//  Static analysis of ROMs (src/RomAnalyzer.hpp), a whole corpus at a time.
+//
+//    chippy-analyze [ROM|DIR]... [--json DIR] [--dot DIR] [--threads N] [--quiet]
+//
+//  Directories are searched for .ch8 files (default: programs). Each ROM
+//  gets a summary line and its findings; --json and --dot write NAME.json
+//  and NAME.dot (Graphviz: dot -Tsvg NAME.dot) into the given directory,
+//  which is created if it is missing.
+//  ROMs are analysed on all cores. The exit status is 1 if any ROM has an
+//  invalid opcode on a reachable path.
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "RomAnalyzer.hpp"
+
+namespace {
+
+struct Options {
+    std::vector<std::string> paths;
+    std::string jsonDir, dotDir;
+    unsigned threads = 0;
+    bool quiet = false;
+};
+
+struct Result {
+    std::string rom;
+    bool loaded = false;
+    bool written = true;
+    RomAnalysis analysis;
+};
+
+void findRoms(const std::string &path, std::vector<std::string> &out)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return;
+    if (!S_ISDIR(st.st_mode)) {
+        out.push_back(path);
+        return;
+    }
+    DIR *d = opendir(path.c_str());
+    if (!d)
+        return;
+    while (dirent *e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name == "." || name == "..")
+            continue;
+        std::string child = path + "/" + name;
+        if (stat(child.c_str(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            findRoms(child, out);
+        else if (name.size() > 4 && name.compare(name.size() - 4, 4, ".ch8") == 0)
+            out.push_back(child);
+    }
+    closedir(d);
+}
+
+// the file name without directory and .ch8.
+std::string baseName(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".ch8") == 0)
+        name.resize(name.size() - 4);
+    return name;
+}
+
+// like mkdir -p; true if path is a directory afterwards.
+bool makeDirectory(const std::string &path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+        errno = S_ISDIR(st.st_mode) ? 0 : ENOTDIR;
+        return errno == 0;
+    }
+    size_t slash = path.find_last_of('/', path.find_last_not_of('/'));
+    if (slash != std::string::npos && slash > 0 && !makeDirectory(path.substr(0, slash)))
+        return false;
+    return mkdir(path.c_str(), 0777) == 0 || errno == EEXIST;
+}
+
+bool writeFile(const std::string &path, const std::string &text)
+{
+    std::ofstream out(path, std::ios::binary);
+    out << text;
+    return (bool)out;
+}
+
+void analyzeOne(const std::string &rom, const Options &opt, Result &r)
+{
+    r.rom = rom;
+    std::ifstream file(rom, std::ios::binary);
+    if (!file)
+        return;
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    r.loaded = true;
+    r.analysis = RomAnalysis::analyze(bytes.data(), bytes.size());
+    const std::string name = baseName(rom);
+    if (!opt.jsonDir.empty())
+        r.written &= writeFile(opt.jsonDir + "/" + name + ".json", r.analysis.json());
+    if (!opt.dotDir.empty())
+        r.written &= writeFile(opt.dotDir + "/" + name + ".dot", r.analysis.dot(name));
+}
+
+void usage()
+{
+    std::cerr << "usage: chippy-analyze [ROM|DIR]... [--json DIR] [--dot DIR] [--threads N] [--quiet]   (default dir: programs)\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto next = [&]() -> const char * {
+            if (i + 1 >= argc) {
+                usage();
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+        if (a == "--json")
+            opt.jsonDir = next();
+        else if (a == "--dot")
+            opt.dotDir = next();
+        else if (a == "--threads")
+            opt.threads = (unsigned)std::atoi(next());
+        else if (a == "--quiet")
+            opt.quiet = true;
+        else if (a == "-h" || a == "--help") {
+            usage();
+            return 0;
+        }
+        else if (a[0] == '-') {
+            usage();
+            return 2;
+        }
+        else
+            opt.paths.push_back(a);
+    }
+    if (opt.paths.empty())
+        opt.paths.push_back("programs");
+    for (const std::string *dir : { &opt.jsonDir, &opt.dotDir }) {
+        if (!dir->empty() && !makeDirectory(*dir)) {
+            std::cerr << "cannot create directory " << *dir << ": " << std::strerror(errno) << std::endl;
+            return 2;
+        }
+    }
+
+    std::vector<std::string> roms;
+    for (auto &p : opt.paths)
+        findRoms(p, roms);
+    std::sort(roms.begin(), roms.end());
+    if (roms.empty()) {
+        std::cerr << "no ROMs found" << std::endl;
+        return 2;
+    }
+
+    unsigned threads = opt.threads ? opt.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<unsigned>(threads, (unsigned)roms.size());
+    std::vector<Result> results(roms.size());
+    std::atomic<size_t> nextRom(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            for (size_t i; (i = nextRom++) < roms.size();)
+                analyzeOne(roms[i], opt, results[i]);
+        });
+    }
+    for (auto &w : workers)
+        w.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    int failed = 0, withInvalid = 0;
+    size_t findings = 0;
+    for (const Result &r : results) {
+        if (!r.loaded) {
+            std::cerr << r.rom << ": could not read" << std::endl;
+            ++failed;
+            continue;
+        }
+        if (!r.written) {
+            std::cerr << r.rom << ": could not write the graph" << std::endl;
+            ++failed;
+        }
+        const RomAnalysis &an = r.analysis;
+        size_t dataBytes = 0;
+        for (const auto &d : an.data)
+            dataBytes += d.end - d.start;
+        findings += an.findings.size();
+        bool invalid = false;
+        for (const auto &f : an.findings)
+            invalid |= f.kind == RomAnalysis::Finding::InvalidOpcode;
+        withInvalid += invalid;
+        if (opt.quiet && an.findings.empty())
+            continue;
+        std::printf("%s: %zu bytes, %zu instructions in %zu blocks, %zu subroutines, %zu data bytes in %zu regions\n",
+                    r.rom.c_str(), an.romSize, an.instructions, an.blocks.size(), an.subroutines.size(), dataBytes,
+                    an.data.size());
+        for (const auto &f : an.findings)
+            std::printf("  0x%03X  %04X  %-18s %s\n", f.address, f.opcode, RomAnalysis::kindName(f.kind),
+                        f.detail.c_str());
+    }
+    std::printf("%zu roms, %zu findings, %d with invalid opcodes, %.3fs on %u threads\n", results.size(), findings,
+                withInvalid, elapsed.count(), threads);
+    return failed ? 2 : withInvalid ? 1 : 0;
+}
@@ -0,0 +1,185 @@
+//
+//  ChippyCycles.cpp
+//  Chippy
+//
+//  The cycle-cost model (src/CycleModel.hpp) from the command line.
+//
+//    chippy-cycles table [--csv|--json]
+//        print the COSMAC VIP cost table.
+//    chippy-cycles profile ROM... [--frames N] [--seed S] [--clock HZ]
+//        run each ROM headless under the model and report where its cycles
+//        go, how many instructions per second it needs at that clock, and
+//        how much of one host core that is at this build's speed.
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "CycleModel.hpp"
+#include "Emulator.hpp"
+
+namespace {
+
+void printTable(const CycleModel &model, const std::string &format)
+{
+    if (format == "json") {
+        std::printf("{\"model\":\"%s\",\"clockHz\":%.0f,\"clocksPerCycle\":%d,\"frameOverhead\":%d,"
+                    "\"frameBudget\":%d,\"drawWaitsForFrame\":%s,\"costs\":[",
+                    model.name, model.clockHz, model.clocksPerCycle, model.frameOverhead, model.frameBudget(),
+                    model.drawWaitsForFrame ? "true" : "false");
+        for (int c = 0; c < CycleModel::classCount; ++c) {
+            const CycleModel::Cost &k = model.costs[c];
+            std::printf("%s{\"opcode\":\"%s\",\"base\":%u,\"taken\":%u,\"perUnit\":%u,\"unit\":", c ? "," : "",
+                        k.pattern, k.base, k.taken, k.perUnit);
+            if (k.unit)
+                std::printf("\"%s\"}", k.unit);
+            else
+                std::printf("null}");
+        }
+        std::printf("]}\n");
+        return;
+    }
+    if (format == "csv") {
+        std::printf("opcode,base,taken,perUnit,unit\n");
+        for (int c = 0; c < CycleModel::classCount; ++c) {
+            const CycleModel::Cost &k = model.costs[c];
+            std::printf("%s,%u,%u,%u,%s\n", k.pattern, k.base, k.taken, k.perUnit, k.unit ? k.unit : "");
+        }
+        return;
+    }
+    std::printf("%s: %.0f Hz, %d clocks per machine cycle, %d cycles per frame for the program%s\n\n", model.name,
+                model.clockHz, model.clocksPerCycle, model.frameBudget(),
+                model.drawWaitsForFrame ? ", Dxyn waits for the next frame" : "");
+    std::printf("%-8s %6s %6s %9s  %s\n", "opcode", "base", "taken", "per unit", "unit");
+    for (int c = 0; c < CycleModel::classCount; ++c) {
+        const CycleModel::Cost &k = model.costs[c];
+        std::printf("%-8s %6u %6s %9s  %s\n", k.pattern, k.base, k.taken ? std::to_string(k.taken).c_str() : "",
+                    k.perUnit ? std::to_string(k.perUnit).c_str() : "", k.unit ? k.unit : "");
+    }
+}
+
+// host instructions per second for this ROM, run the usual way; 0 if it
+// spends the time waiting for a key instead.
+double hostSpeed(const std::string &rom, uint32_t seed)
+{
+    Emulator emu;
+    emu.seedRandom(seed);
+    emu.loadBinary(rom);
+    emu.instructionsPerFrame = 1000;
+    auto start = std::chrono::steady_clock::now();
+    double seconds = 0;
+    while (!emu.halted && seconds < 0.2) {
+        for (int f = 0; f < 50; ++f)
+            emu.runFrame();
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return seconds > 0 && emu.statTotalInstructions >= 100000 ? emu.statTotalInstructions / seconds : 0;
+}
+
+int profile(const std::string &rom, const CycleModel &model, int frames, uint32_t seed)
+{
+    Emulator emu;
+    emu.seedRandom(seed);
+    if (!emu.loadBinary(rom)) {
+        std::cerr << "could not load " << rom << std::endl;
+        return 1;
+    }
+    CycleProfile profile;
+    emu.cycleModel = &model;
+    emu.cycleProfile = &profile;
+    for (int f = 0; f < frames && !emu.halted; ++f)
+        emu.runFrame();
+
+    const double seconds = profile.frames / 60.0;
+    const double ips = seconds > 0 ? emu.statTotalInstructions / seconds : 0;
+    std::printf("%s: %llu frames, %llu instructions, %llu cycles%s\n", rom.c_str(),
+                (unsigned long long)profile.frames, (unsigned long long)emu.statTotalInstructions,
+                (unsigned long long)emu.statTotalCycles, emu.halted ? " (halted)" : "");
+    std::printf("  %.1f instructions per frame, %.0f per second at %.0f Hz\n",
+                profile.frames ? (double)emu.statTotalInstructions / profile.frames : 0.0, ips, model.clockHz);
+    std::printf("  %llu frames ended by a Dxyn wait, %llu idle (Fx0A or halted)\n",
+                (unsigned long long)profile.drawWaits, (unsigned long long)profile.idleFrames);
+
+    std::printf("  %-8s %10s %12s %7s\n", "opcode", "count", "cycles", "share");
+    for (int c = 0; c < CycleModel::classCount; ++c) {
+        if (!profile.count[c])
+            continue;
+        std::printf("  %-8s %10llu %12llu %6.1f%%\n", model.costs[c].pattern, (unsigned long long)profile.count[c],
+                    (unsigned long long)profile.cycles[c],
+                    emu.statTotalCycles ? 100.0 * profile.cycles[c] / emu.statTotalCycles : 0.0);
+    }
+
+    const double host = hostSpeed(rom, seed);
+    if (host > 0)
+        std::printf("  host runs %.1fM instructions/s: %.4f%% of one core at this clock\n", host / 1e6,
+                    100.0 * ips / host);
+    else
+        std::printf("  host speed not measured: the ROM stops for a key or halts\n");
+    return 0;
+}
+
+void usage()
+{
+    std::cerr << "usage: chippy-cycles table [--csv|--json]\n"
+                 "       chippy-cycles profile ROM... [--frames N] [--seed S] [--clock HZ]\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        usage();
+        return 2;
+    }
+    std::string mode = argv[1];
+    std::string format = "text";
+    std::vector<std::string> roms;
+    int frames = 600;
+    uint32_t seed = 1;
+    CycleModel model = CycleModel::vip();
+    for (int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--csv" || a == "--json")
+            format = a.substr(2);
+        else if (a.compare(0, 2, "--") != 0)
+            roms.push_back(a);
+        else if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        else if (a == "--frames")
+            frames = std::atoi(argv[++i]);
+        else if (a == "--seed")
+            seed = (uint32_t)std::strtoul(argv[++i], nullptr, 0);
+        else if (a == "--clock")
+            model.clockHz = std::atof(argv[++i]);
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (mode == "table" && roms.empty()) {
+        printTable(model, format);
+        return 0;
+    }
+    if (mode == "profile" && !roms.empty()) {
+        if (model.frameBudget() <= 0) {
+            std::cerr << "clock too slow: nothing left for the program after the frame overhead" << std::endl;
+            return 2;
+        }
+        int status = 0;
+        for (const auto &rom : roms)
+            status |= profile(rom, model, frames, seed);
+        return status;
+    }
+    usage();
+    return 2;
+}
@@ -0,0 +1,210 @@
+//
+//  ChippyDebug.cpp
+//  Chippy
+//
+//  Headless command-line front end for src/Debugger.hpp.
+//
+//    chippy-debug ROM [--seed S] [-ex "command"]...
+//
+//  Commands are read from stdin after any -ex ones; `help` lists them.
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Debugger.hpp"
+#include "Disassembler.hpp"
+#include "Emulator.hpp"
+#include "TerminalRenderer.hpp"
+
+namespace {
+
+const uint64_t defaultBudget = 100000000; // instructions for c/n/out before giving up
+
+const char helpText[] =
+    "  s [N]                 step N instructions (default 1)\n"
+    "  n                     step over (runs a whole CALL)\n"
+    "  out                   step out of the current subroutine\n"
+    "  c [N]                 continue for at most N instructions\n"
+    "  frames N              run N frames (stops early on a break)\n"
+    "  b ADDR / d ADDR       set / delete a breakpoint\n"
+    "  watch r|w|rw ADDR [LEN]  stop before an access to memory\n"
+    "  cond EXPR             stop when EXPR becomes true: V3 == 0x10, I >= 0x300, [0x3F0] != 0, PC == 0x2A4, DT == 0\n"
+    "  clear                 remove all breakpoints, watchpoints and conditions\n"
+    "  info                  list breakpoints and conditions\n"
+    "  regs                  registers, timers and stack\n"
+    "  x ADDR [LEN]          dump memory\n"
+    "  dis [ADDR] [N]        disassemble (default: from pc)\n"
+    "  keys MASK             hold the given 16-bit key mask\n"
+    "  screen                print the display\n"
+    "  q                     quit\n";
+
+struct Session {
+    Emulator emulator;
+    Debugger debugger;
+};
+
+uint32_t number(const std::string &s, uint32_t fallback = 0)
+{
+    if (s.empty())
+        return fallback;
+    return (uint32_t)std::strtoul(s.c_str(), nullptr, 0);
+}
+
+void report(Session &s, Debugger::Stop stop)
+{
+    if (stop == Debugger::Stop::ReadWatch || stop == Debugger::Stop::WriteWatch)
+        std::printf("stopped: %s at 0x%03X\n", Debugger::stopName(stop), s.debugger.lastStopAddress());
+    else if (stop != Debugger::Stop::Step)
+        std::printf("stopped: %s\n", Debugger::stopName(stop));
+    std::printf("%s\n", Debugger::describeState(s.emulator).c_str());
+}
+
+bool execute(Session &s, const std::string &line)
+{
+    std::istringstream in(line);
+    std::string cmd, a, b, c;
+    in >> cmd >> a >> b >> c;
+    Emulator &emu = s.emulator;
+    Debugger &dbg = s.debugger;
+
+    if (cmd.empty())
+        return true;
+    if (cmd == "q" || cmd == "quit")
+        return false;
+    if (cmd == "help" || cmd == "h") {
+        std::fputs(helpText, stdout);
+    }
+    else if (cmd == "s" || cmd == "step") {
+        uint32_t n = number(a, 1);
+        Debugger::Stop stop = Debugger::Stop::Step;
+        for (uint32_t i = 0; i < n && stop == Debugger::Stop::Step; ++i)
+            stop = dbg.step(emu);
+        report(s, stop);
+    }
+    else if (cmd == "n" || cmd == "next") {
+        report(s, dbg.stepOver(emu, defaultBudget));
+    }
+    else if (cmd == "out" || cmd == "finish") {
+        report(s, dbg.stepOut(emu, defaultBudget));
+    }
+    else if (cmd == "c" || cmd == "continue") {
+        report(s, dbg.run(emu, number(a, 0) ? number(a) : defaultBudget));
+    }
+    else if (cmd == "frames") {
+        Debugger::Stop stop = Debugger::Stop::None;
+        for (uint32_t i = 0; i < number(a, 1) && stop == Debugger::Stop::None; ++i)
+            stop = dbg.runFrame(emu);
+        report(s, stop);
+    }
+    else if (cmd == "b" || cmd == "break") {
+        dbg.setBreakpoint(number(a, emu.getPC()));
+    }
+    else if (cmd == "d" || cmd == "delete") {
+        dbg.setBreakpoint(number(a, emu.getPC()), false);
+    }
+    else if (cmd == "watch") {
+        bool r = a.find('r') != std::string::npos, w = a.find('w') != std::string::npos;
+        if ((!r && !w) || b.empty())
+            std::printf("usage: watch r|w|rw ADDR [LEN]\n");
+        else
+            dbg.setWatch(number(b), number(c, 1), r, w);
+    }
+    else if (cmd == "cond") {
+        Debugger::Condition cond;
+        std::string expr = line.substr(line.find("cond") + 4);
+        if (Debugger::parseCondition(expr, cond))
+            dbg.addCondition(cond);
+        else
+            std::printf("could not parse condition '%s'\n", expr.c_str());
+    }
+    else if (cmd == "clear") {
+        dbg.clearAll();
+    }
+    else if (cmd == "info") {
+        std::printf("breakpoints:");
+        for (int i = 0; i < 0x1000; ++i)
+            if (dbg.getBreakpoints()[i])
+                std::printf(" %03X", i);
+        std::printf("\nconditions:\n");
+        for (auto &cond : dbg.getConditions())
+            std::printf("  %s\n", Debugger::describe(cond).c_str());
+    }
+    else if (cmd == "regs" || cmd == "r") {
+        std::printf("%s\n", Debugger::describeState(emu).c_str());
+    }
+    else if (cmd == "x") {
+        uint32_t addr = number(a), len = number(b, 16);
+        for (uint32_t i = 0; i < len; ++i)
+            std::printf("%s%02X", i % 16 == 0 ? (i ? "\n" : "") : " ", emu.peekMemory((uint16_t)(addr + i)));
+        std::printf("\n");
+    }
+    else if (cmd == "dis") {
+        uint32_t addr = a.empty() ? emu.getPC() : number(a), n = number(b, 10);
+        for (uint32_t i = 0; i < n; ++i, addr += 2) {
+            uint16_t op = (emu.peekMemory((uint16_t)addr) << 8) | emu.peekMemory((uint16_t)(addr + 1));
+            std::printf("%s %03X  %04X  %s\n", (addr & 0xFFF) == emu.getPC() ? "=>" : "  ", addr & 0xFFF, op,
+                        disassemble(op).c_str());
+        }
+    }
+    else if (cmd == "keys") {
+        emu.setKeyMask((uint16_t)number(a));
+    }
+    else if (cmd == "screen") {
+        std::fputs(TerminalRenderer::plainText(emu).c_str(), stdout);
+    }
+    else {
+        std::printf("unknown command '%s' (try help)\n", cmd.c_str());
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::string rom;
+    uint32_t seed = 1;
+    std::vector<std::string> commands;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--seed" && i + 1 < argc)
+            seed = number(argv[++i]);
+        else if (arg == "-ex" && i + 1 < argc)
+            commands.push_back(argv[++i]);
+        else
+            rom = arg;
+    }
+    if (rom.empty()) {
+        std::cerr << "usage: chippy-debug ROM [--seed S] [-ex \"command\"]..." << std::endl;
+        return 2;
+    }
+
+    Session s;
+    s.emulator.seedRandom(seed);
+    if (!s.emulator.loadBinary(rom)) {
+        std::cerr << "could not load " << rom << std::endl;
+        return 1;
+    }
+
+    for (auto &cmd : commands) {
+        std::printf("(chippy) %s\n", cmd.c_str());
+        if (!execute(s, cmd))
+            return 0;
+    }
+    std::string line;
+    for (;;) {
+        std::printf("(chippy) ");
+        std::fflush(stdout);
+        if (!std::getline(std::cin, line) || !execute(s, line))
+            break;
+    }
+    return 0;
+}
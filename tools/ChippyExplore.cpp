@@ -0,0 +1,164 @@
+//
+//  ChippyExplore.cpp
+//  Chippy
+//
+//  Searches a ROM's input space for a key sequence that reaches a goal.
+//
+//    chippy-explore ROM --goal G [--goal G...] [--best SCORE] [--keys K,K,...]
+//                   [--frames N] [--boot N] [--max-states N] [--max-depth N]
+//                   [--max-frontier N] [--threads N] [--ipf N] [--seed S]
+//
+//  Goals are "halt", "pc-range" or debugger conditions ("[0x3F0] >= 1",
+//  "V3 == 0x10"); the first one reached wins. The search is breadth-first
+//  unless --best gives a value to maximise ("V3", "[0x2F0]"). --keys limits
+//  the choices to no key and each listed keypad key (hex), --frames is how long
+//  each choice is held and --boot runs that many frames with no keys first.
+//  The answer is printed as one line per step.
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Emulator.hpp"
+#include "Explorer.hpp"
+
+namespace {
+
+void usage()
+{
+    std::cerr << "usage: chippy-explore ROM --goal G [--goal G...] [--best SCORE] [--keys K,K,...]\n"
+                 "                      [--frames N] [--boot N] [--max-states N] [--max-depth N]\n"
+                 "                      [--max-frontier N] [--threads N] [--ipf N] [--seed S]\n"
+                 "goals: halt, pc-range, or a condition such as \"[0x3F0] >= 1\" or \"V3 == 0x10\"\n";
+}
+
+bool parseKeys(const char *text, std::vector<uint16_t> &choices)
+{
+    choices.assign(1, 0);
+    for (const char *p = text; *p;) {
+        char *end;
+        unsigned long key = std::strtoul(p, &end, 16);
+        if (end == p || key > 0xF)
+            return false;
+        choices.push_back((uint16_t)(1 << key));
+        p = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',')
+            return false;
+    }
+    return true;
+}
+
+std::string keyList(uint16_t mask)
+{
+    if (!mask)
+        return "-";
+    std::string s;
+    for (int k = 0; k < 16; ++k) {
+        if (mask & (1 << k)) {
+            if (!s.empty())
+                s += ' ';
+            s += "0123456789ABCDEF"[k];
+        }
+    }
+    return s;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::string rom;
+    std::vector<Explorer::Goal> goals;
+    Explorer::Options options;
+    int boot = 0, instructionsPerFrame = 10;
+    uint32_t seed = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a[0] != '-' && rom.empty()) {
+            rom = a;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        const char *v = argv[++i];
+        if (a == "--goal") {
+            Explorer::Goal g;
+            if (!Explorer::parseGoal(v, g)) {
+                std::cerr << "bad goal: " << v << std::endl;
+                return 2;
+            }
+            goals.push_back(g);
+        }
+        else if (a == "--best") {
+            // a condition's left-hand side is exactly a value to rank by.
+            if (!Debugger::parseCondition(std::string(v) + " >= 0", options.score)) {
+                std::cerr << "bad score: " << v << std::endl;
+                return 2;
+            }
+            options.order = Explorer::Order::BestFirst;
+        }
+        else if (a == "--keys") {
+            if (!parseKeys(v, options.choices)) {
+                std::cerr << "bad key list: " << v << std::endl;
+                return 2;
+            }
+        }
+        else if (a == "--frames")
+            options.framesPerStep = std::max(1, std::atoi(v));
+        else if (a == "--boot")
+            boot = std::atoi(v);
+        else if (a == "--max-states")
+            options.maxStates = std::strtoull(v, nullptr, 0);
+        else if (a == "--max-depth")
+            options.maxDepth = std::atoi(v);
+        else if (a == "--max-frontier")
+            options.maxFrontier = std::strtoull(v, nullptr, 0);
+        else if (a == "--threads")
+            options.threads = std::atoi(v);
+        else if (a == "--ipf")
+            instructionsPerFrame = std::max(1, std::atoi(v));
+        else if (a == "--seed")
+            seed = (uint32_t)std::strtoul(v, nullptr, 0);
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (rom.empty() || goals.empty()) {
+        usage();
+        return 2;
+    }
+
+    Emulator start;
+    start.seedRandom(seed);
+    start.instructionsPerFrame = instructionsPerFrame;
+    if (!start.loadBinary(rom)) {
+        std::cerr << "could not load " << rom << std::endl;
+        return 1;
+    }
+    for (int f = 0; f < boot; ++f)
+        start.runFrame();
+
+    Explorer::Result r = Explorer::run(start, goals, options);
+    std::printf("%llu states (%llu duplicates dropped%s) in %.2fs, %.0f states/s\n",
+                (unsigned long long)r.states, (unsigned long long)r.duplicates,
+                r.dropped ? ", frontier full" : "", r.seconds, r.states / std::max(r.seconds, 1e-9));
+    if (!r.found) {
+        std::printf("no goal reached\n");
+        return 1;
+    }
+    std::printf("reached %s after %zu steps of %d frames (after %d boot frames):\n",
+                Explorer::describe(goals[r.goal]).c_str(), r.inputs.size(), options.framesPerStep, boot);
+    for (size_t i = 0; i < r.inputs.size(); ++i)
+        std::printf("  %4zu  keys %s\n", i, keyList(r.inputs[i]).c_str());
+    return 0;
+}
@@ -0,0 +1,132 @@
+//
+//  ChippyInspect.cpp
+//  Chippy
+//
+//  Reads the live state a running emulator publishes through StatePublisher.
+//
+//    chippy-inspect [NAME] [--interval MS] [--count N] [--screen] [--memory ADDR[:LEN]]
+//
+//  NAME is the shared-memory segment (default /chippy, as given to
+//  `chippy-term --publish`). Every interval it takes a consistent snapshot
+//  and prints one line of stats (rates are over the interval), optionally
+//  followed by the display and a memory dump. Readers never slow the
+//  emulator down, so any number can watch at any rate.
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "StatePublisher.hpp"
+#include "TerminalRenderer.hpp"
+
+namespace {
+
+void usage()
+{
+    std::cerr << "usage: chippy-inspect [NAME] [--interval MS] [--count N] [--screen] [--memory ADDR[:LEN]]\n";
+}
+
+void dumpMemory(const LiveState &s, unsigned from, unsigned length)
+{
+    for (unsigned a = from; a < from + length && a < 0x1000; a += 16) {
+        std::printf("  %03X ", a);
+        for (unsigned i = a; i < a + 16 && i < from + length && i < 0x1000; ++i)
+            std::printf(" %02X", s.memory[i]);
+        std::printf("\n");
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::string name = "/chippy";
+    int intervalMs = 1000;
+    long count = -1;
+    bool screen = false;
+    unsigned memFrom = 0, memLength = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (a == "--screen")
+            screen = true;
+        else if (a == "--interval" && hasValue)
+            intervalMs = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--count" && hasValue)
+            count = std::atol(argv[++i]);
+        else if (a == "--memory" && hasValue) {
+            char *end;
+            memFrom = (unsigned)std::strtoul(argv[++i], &end, 0) & 0xFFF;
+            memLength = *end == ':' ? (unsigned)std::strtoul(end + 1, nullptr, 0) : 16;
+        }
+        else if (a[0] != '-')
+            name = a;
+        else {
+            usage();
+            return 2;
+        }
+    }
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        std::cerr << "no live state at " << name << " (is the emulator publishing?)" << std::endl;
+        return 1;
+    }
+    void *p = mmap(nullptr, sizeof(LiveState), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        std::cerr << "could not map " << name << std::endl;
+        return 1;
+    }
+    const LiveState &shared = *static_cast<const LiveState *>(p);
+    if (shared.magic != LiveState::magicValue || shared.version != LiveState::currentVersion) {
+        std::cerr << name << " is not a chippy live state segment (or a different version)" << std::endl;
+        return 1;
+    }
+
+    std::unique_ptr<LiveState> snapshot(new LiveState), last(new LiveState);
+    bool haveLast = false;
+    for (long n = 0; count < 0 || n < count; ++n) {
+        if (n)
+            std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+        if (!LiveState::read(shared, *snapshot)) {
+            std::printf("writer busy, no consistent snapshot\n");
+            continue;
+        }
+        const LiveState &s = *snapshot;
+        double fps = 0, ips = 0;
+        if (haveLast && s.timestampNs > last->timestampNs) {
+            double seconds = (s.timestampNs - last->timestampNs) / 1e9;
+            fps = (s.frames - last->frames) / seconds;
+            ips = (s.totalInstructions - last->totalInstructions) / seconds;
+        }
+        double age = (Emulator::timestampNow() - s.timestampNs) / 1e6;
+        std::printf("snapshot %llu  %.0f/s  %.0f ips  age %.1f ms  pc %03X  I %03X  sp %d  DT %02X  ST %02X  keys %04X%s%s\n",
+                    (unsigned long long)s.frames, fps, ips, age, s.pc, s.I, s.sp, s.delayTimer, s.soundTimer, s.keys,
+                    s.waitForKey ? "  [waiting for key]" : "", s.halted ? "  [halted]" : "");
+        std::printf("  V:");
+        for (int r = 0; r < 16; ++r)
+            std::printf(" %02X", s.vReg[r]);
+        std::printf("\n");
+        if (screen)
+            std::printf("%s", TerminalRenderer::plainText(s.display).c_str());
+        if (memLength)
+            dumpMemory(s, memFrom, memLength);
+        std::fflush(stdout);
+        std::swap(snapshot, last);
+        haveLast = true;
+    }
+    return 0;
+}
@@ -0,0 +1,216 @@
+//
+//  ChippyLink.cpp
+//  Chippy
+//
+//  Plays a two-player ROM headless over a RollbackLink, with scripted keys.
+//
+//    chippy-link ROM --port P --peer HOST:PORT [options]   one peer; start the other likewise
+//    chippy-link ROM --loopback [options]                  both peers, one thread each
+//
+//  options: [--frames N] [--keys K,K,...] [--script SEED] [--seed S] [--ipf N]
+//           [--max-rollback N] [--delay N] [--lag N] [--fps N]
+//
+//  Each peer presses a random subset of its --keys now and then (player one
+//  1,4 and player two C,D in --loopback, as in Pong), runs at --fps and
+//  prints the link's stats at the end: rollbacks, their depth and cost,
+//  stalls, bandwidth and the sync checks against the other peer. --lag holds
+//  every packet that many frames to make rollbacks deeper on loopback.
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Emulator.hpp"
+#include "RollbackLink.hpp"
+
+namespace {
+
+struct Options {
+    std::string rom;
+    int port = 0;
+    std::string peerHost;
+    int peerPort = 0;
+    bool loopback = false;
+    int frames = 600;
+    std::vector<int> keys;
+    uint32_t script = 1;
+    uint32_t seed = 1;
+    int instructionsPerFrame = 10;
+    int fps = 60;
+    RollbackLink::Options link;
+};
+
+void usage()
+{
+    std::cerr << "usage: chippy-link ROM --port P --peer HOST:PORT [options]\n"
+                 "       chippy-link ROM --loopback [options]\n"
+                 "options: [--frames N] [--keys K,K,...] [--script SEED] [--seed S] [--ipf N]\n"
+                 "         [--max-rollback N] [--delay N] [--lag N] [--fps N]\n";
+}
+
+bool parseKeys(const char *text, std::vector<int> &keys)
+{
+    keys.clear();
+    for (const char *p = text; *p;) {
+        char *end;
+        unsigned long key = std::strtoul(p, &end, 16);
+        if (end == p || key > 0xF || (*end && *end != ','))
+            return false;
+        keys.push_back((int)key);
+        p = *end == ',' ? end + 1 : end;
+    }
+    return !keys.empty();
+}
+
+void printStats(const char *name, const RollbackLink &link, double seconds)
+{
+    const RollbackLink::Stats &s = link.stats();
+    std::printf("%s: %llu frames, %llu stalls, advantage %d\n", name,
+                (unsigned long long)s.frames, (unsigned long long)s.stalls, s.frameAdvantage);
+    std::printf("  rollbacks %llu, %llu frames re-run (depth max %d, mean %.1f), resimulation max %.3f ms\n",
+                (unsigned long long)s.rollbacks, (unsigned long long)s.resimulatedFrames, s.maxRollbackDepth,
+                s.rollbacks ? (double)s.resimulatedFrames / s.rollbacks : 0.0, s.maxResimulationMs);
+    std::printf("  sent %llu packets / %llu bytes (%.0f B/s), received %llu / %llu, rejected %llu\n",
+                (unsigned long long)s.packetsSent, (unsigned long long)s.bytesSent, s.bytesSent / std::max(seconds, 1e-9),
+                (unsigned long long)s.packetsReceived, (unsigned long long)s.bytesReceived,
+                (unsigned long long)s.packetsRejected);
+    std::printf("  %llu sync checks, %llu desyncs\n", (unsigned long long)s.syncChecks, (unsigned long long)s.desyncs);
+}
+
+// runs one peer to opt.frames; false if it could not start or went out of sync.
+bool runPeer(const Options &opt, const std::vector<int> &keys, uint32_t script,
+             int port, const std::string &host, int peerPort, const char *name)
+{
+    Emulator emu;
+    emu.seedRandom(opt.seed);
+    emu.instructionsPerFrame = opt.instructionsPerFrame;
+    if (!emu.loadBinary(opt.rom)) {
+        std::cerr << "could not load " << opt.rom << std::endl;
+        return false;
+    }
+    RollbackLink link(emu, opt.link);
+    if (!link.open(port, host, peerPort)) {
+        std::perror("chippy-link");
+        return false;
+    }
+
+    typedef std::chrono::steady_clock Clock;
+    const auto frameTime = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / opt.fps));
+    auto start = Clock::now(), deadline = start, progress = start;
+    uint32_t state = script | 1;
+    uint16_t mask = 0;
+    // a few more frames after the last counted one, so the final inputs get to the other side.
+    const uint64_t total = (uint64_t)opt.frames + 30;
+    while (link.frame() < total) {
+        deadline += frameTime;
+        std::this_thread::sleep_until(deadline);
+        if (link.frame() < (uint64_t)opt.frames) {
+            state = state * 1664525 + 1013904223;
+            if ((state >> 24) < 32) {
+                mask = 0;
+                for (int k : keys)
+                    if ((state >> (8 + k)) & 1)
+                        mask |= 1 << k;
+            }
+        }
+        else
+            mask = 0;
+        if (link.advance(mask))
+            progress = deadline;
+        else if (deadline - progress > std::chrono::seconds(10)) {
+            std::cerr << name << ": " << (link.connected() ? "peer stopped answering" : "no peer (same ROM and --seed?)") << std::endl;
+            return false;
+        }
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    printStats(name, link, seconds);
+    return link.stats().desyncs == 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--loopback") {
+            opt.loopback = true;
+            continue;
+        }
+        if (a[0] != '-' && opt.rom.empty()) {
+            opt.rom = a;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        const char *v = argv[++i];
+        if (a == "--port")
+            opt.port = std::atoi(v);
+        else if (a == "--peer") {
+            const char *colon = std::strrchr(v, ':');
+            if (!colon) {
+                usage();
+                return 2;
+            }
+            opt.peerHost.assign(v, colon);
+            opt.peerPort = std::atoi(colon + 1);
+        }
+        else if (a == "--frames")
+            opt.frames = std::max(1, std::atoi(v));
+        else if (a == "--keys") {
+            if (!parseKeys(v, opt.keys)) {
+                std::cerr << "bad key list: " << v << std::endl;
+                return 2;
+            }
+        }
+        else if (a == "--script")
+            opt.script = (uint32_t)std::strtoul(v, nullptr, 0);
+        else if (a == "--seed")
+            opt.seed = (uint32_t)std::strtoul(v, nullptr, 0);
+        else if (a == "--ipf")
+            opt.instructionsPerFrame = std::max(1, std::atoi(v));
+        else if (a == "--max-rollback")
+            opt.link.maxRollback = std::atoi(v);
+        else if (a == "--delay")
+            opt.link.inputDelay = std::atoi(v);
+        else if (a == "--lag")
+            opt.link.simulatedLatency = std::atoi(v);
+        else if (a == "--fps")
+            opt.fps = std::max(1, std::atoi(v));
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (opt.rom.empty() || (!opt.loopback && (!opt.port || !opt.peerPort))) {
+        usage();
+        return 2;
+    }
+
+    if (!opt.loopback) {
+        std::vector<int> keys = opt.keys.empty() ? std::vector<int>{ 0x1, 0x4 } : opt.keys;
+        return runPeer(opt, keys, opt.script, opt.port, opt.peerHost, opt.peerPort, "peer") ? 0 : 1;
+    }
+
+    // loopback: player two on the next port up, with its own script.
+    int base = opt.port ? opt.port : 47800;
+    bool ok[2] = { false, false };
+    std::thread second([&] {
+        ok[1] = runPeer(opt, { 0xC, 0xD }, opt.script * 2654435761u, base + 1, "127.0.0.1", base, "player 2");
+    });
+    ok[0] = runPeer(opt, { 0x1, 0x4 }, opt.script, base, "127.0.0.1", base + 1, "player 1");
+    second.join();
+    return ok[0] && ok[1] ? 0 : 1;
+}
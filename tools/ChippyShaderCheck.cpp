@@ -0,0 +1,299 @@
+//
+//  ChippyShaderCheck.cpp
+//  Chippy
+//
+//  Runs DisplayShader's GLSL (src/DisplayShaderSource.hpp) headless under
+//  EGL, without a window or a GPU, and compares what it draws with the app's
+//  CPU expansion of the display.
+//
+//    chippy-shadercheck [ROM] [--frames N] [--scale N]
+//
+//  The ROM (default: the IBM logo) runs N frames (default 30); its display is
+//  uploaded packed, as DisplayShader::update(const Emulator&) does, and a ramp
+//  of every level is uploaded as a shaded frame. Both are drawn at --scale
+//  (default 4) times 64x32 into an offscreen framebuffer: once with the plain
+//  palette, which must match the RGB texture ChippyApp falls back to, and
+//  once with a colour palette and scanlines against the same expansion done
+//  here. Mesa's software rasterizer (llvmpipe) is used unless
+//  LIBGL_ALWAYS_SOFTWARE is set already (=0 for the GPU). The exit status is
+//  1 on a mismatch and 2 if there is no GL 3.2 context.
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "DisplayShaderSource.hpp"
+#include "Emulator.hpp"
+
+namespace {
+
+struct Palette {
+    float off[3], on[3];
+    float scanlines;
+};
+
+bool createContext()
+{
+    EGLDisplay display = EGL_NO_DISPLAY;
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor) || !eglBindAPI(EGL_OPENGL_API))
+        return false;
+    const EGLint configAttributes[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                                        EGL_NONE };
+    EGLConfig config;
+    EGLint configs = 0;
+    if (!eglChooseConfig(display, configAttributes, &config, 1, &configs) || configs < 1)
+        return false;
+    // the same profile the shader's #version 150 asks for.
+    const EGLint contextAttributes[] = { EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 2,
+                                         EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                         EGL_NONE };
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+    // no surface: everything is drawn into a framebuffer object.
+    return context != EGL_NO_CONTEXT && eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+}
+
+GLuint compile(GLenum type, const char *source)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    GLint ok = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        std::cerr << "shader does not compile: " << log << std::endl;
+        return 0;
+    }
+    return shader;
+}
+
+GLuint link()
+{
+    GLuint vertex = compile(GL_VERTEX_SHADER, shaders::vertexSource);
+    GLuint fragment = compile(GL_FRAGMENT_SHADER, shaders::fragmentSource);
+    if (!vertex || !fragment)
+        return 0;
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertex);
+    glAttachShader(program, fragment);
+    glBindAttribLocation(program, 0, "ciPosition");
+    glBindAttribLocation(program, 1, "ciTexCoord0");
+    glBindFragDataLocation(program, 0, "oColor");
+    glLinkProgram(program);
+    GLint ok = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+        std::cerr << "shader does not link: " << log << std::endl;
+        return 0;
+    }
+    return program;
+}
+
+GLuint createTexture(int width, int height, const uint8_t *data)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, data);
+    return texture;
+}
+
+// what DisplayShader::draw() does through Cinder: a window-sized quad, y down,
+// texture coordinates (0, 0) top left. Returns RGB rows top first.
+std::vector<uint8_t> draw(GLuint program, GLuint texture, bool packed, const Palette &palette, int scale)
+{
+    const int width = displayWidth * scale, height = displayHeight * scale;
+    GLuint target, framebuffer;
+    glGenRenderbuffers(1, &target);
+    glBindRenderbuffer(GL_RENDERBUFFER, target);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target);
+    glViewport(0, 0, width, height);
+
+    const float quad[] = { 0, 0, 0, 0,   (float)width, 0, 1, 0,
+                           0, (float)height, 0, 1,   (float)width, (float)height, 1, 1 };
+    GLuint array, buffer;
+    glGenVertexArrays(1, &array);
+    glBindVertexArray(array);
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), nullptr);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)(2 * sizeof(float)));
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+
+    // window coordinates to clip space, column major.
+    const float projection[16] = { 2.0f / width, 0, 0, 0,   0, -2.0f / height, 0, 0,   0, 0, -1, 0,   -1, 1, 0, 1 };
+    glUseProgram(program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glUniformMatrix4fv(glGetUniformLocation(program, "ciModelViewProjection"), 1, GL_FALSE, projection);
+    glUniform1i(glGetUniformLocation(program, "uDisplay"), 0);
+    glUniform1i(glGetUniformLocation(program, "uPacked"), packed ? 1 : 0);
+    glUniform3fv(glGetUniformLocation(program, "uOff"), 1, palette.off);
+    glUniform3fv(glGetUniformLocation(program, "uOn"), 1, palette.on);
+    glUniform1f(glGetUniformLocation(program, "uScale"), (float)scale);
+    glUniform1f(glGetUniformLocation(program, "uScanlines"), palette.scanlines);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+    std::vector<uint8_t> rgba((size_t)width * height * 4), rgb((size_t)width * height * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+    // GL rows run bottom up.
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            for (int c = 0; c < 3; ++c)
+                rgb[((size_t)y * width + x) * 3 + c] = rgba[((size_t)(height - 1 - y) * width + x) * 4 + c];
+
+    glDeleteBuffers(1, &buffer);
+    glDeleteVertexArrays(1, &array);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &target);
+    return rgb;
+}
+
+// ChippyApp's texture path: one grey byte per CHIP-8 pixel, scaled up by
+// repetition, then the palette and scanlines as the shader defines them.
+std::vector<uint8_t> expand(const uint8_t grey[displayHeight][displayWidth], const Palette &palette, int scale)
+{
+    const int width = displayWidth * scale, height = displayHeight * scale;
+    const int gap = std::max(1, scale / 4);
+    std::vector<uint8_t> rgb((size_t)width * height * 3);
+    for (int y = 0; y < height; ++y) {
+        const bool darkened = palette.scanlines > 0 && scale >= 3 && y % scale >= scale - gap;
+        for (int x = 0; x < width; ++x) {
+            const float level = grey[y / scale][x / scale] / 255.0f;
+            for (int c = 0; c < 3; ++c) {
+                float value = palette.off[c] + (palette.on[c] - palette.off[c]) * level;
+                if (darkened)
+                    value *= 1.0f - palette.scanlines;
+                rgb[((size_t)y * width + x) * 3 + c] = (uint8_t)std::lround(value * 255.0f);
+            }
+        }
+    }
+    return rgb;
+}
+
+// the most any channel is off by; GL may round a level either way.
+int compare(const std::vector<uint8_t> &drawn, const std::vector<uint8_t> &expected, int scale, const char *what)
+{
+    int worst = 0;
+    size_t where = 0;
+    for (size_t i = 0; i < drawn.size(); ++i) {
+        int d = std::abs((int)drawn[i] - (int)expected[i]);
+        if (d > worst) {
+            worst = d;
+            where = i / 3;
+        }
+    }
+    const int width = displayWidth * scale;
+    if (worst > 1)
+        std::printf("%-28s differs by up to %d at (%d, %d)\n", what, worst, (int)(where % width), (int)(where / width));
+    else
+        std::printf("%-28s ok\n", what);
+    return worst;
+}
+
+void usage()
+{
+    std::cerr << "usage: chippy-shadercheck [ROM] [--frames N] [--scale N]\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::string rom = "programs/chip8 programs/IBM Logo.ch8";
+    int frames = 30, scale = 4;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--frames" && i + 1 < argc)
+            frames = std::atoi(argv[++i]);
+        else if (a == "--scale" && i + 1 < argc)
+            scale = std::max(1, std::atoi(argv[++i]));
+        else if (a[0] != '-')
+            rom = a;
+        else {
+            usage();
+            return 2;
+        }
+    }
+
+    Emulator emu;
+    if (!emu.loadBinary(rom)) {
+        std::cerr << "could not load " << rom << std::endl;
+        return 2;
+    }
+    for (int f = 0; f < frames; ++f)
+        emu.runFrame();
+
+    setenv("LIBGL_ALWAYS_SOFTWARE", "1", 0);
+    if (!createContext()) {
+        std::cerr << "no OpenGL 3.2 core context through EGL" << std::endl;
+        return 2;
+    }
+    std::printf("%s, %s\n", (const char *)glGetString(GL_RENDERER), (const char *)glGetString(GL_VERSION));
+    GLuint program = link();
+    if (!program)
+        return 1;
+
+    // the two layouts DisplayShader uploads, and the grey bytes the app's texture would hold.
+    uint8_t packed[displayHeight * displayWidth / 8];
+    emu.packDisplay(packed);
+    uint8_t levels[displayHeight][displayWidth], displayGrey[displayHeight][displayWidth];
+    for (int y = 0; y < displayHeight; ++y) {
+        for (int x = 0; x < displayWidth; ++x) {
+            levels[y][x] = (uint8_t)((y * displayWidth + x) * 255 / (displayHeight * displayWidth - 1));
+            displayGrey[y][x] = emu.display[y][x] ? 255 : 0;
+        }
+    }
+    GLuint packedTexture = createTexture(displayWidth / 8, displayHeight, packed);
+    GLuint levelTexture = createTexture(displayWidth, displayHeight, &levels[0][0]);
+
+    const Palette plain = { { 0, 0, 0 }, { 1, 1, 1 }, 0 };
+    const Palette amber = { { 0.1f, 0.05f, 0 }, { 1, 0.7f, 0.2f }, 0.5f };
+    int worst = 0;
+    worst = std::max(worst, compare(draw(program, packedTexture, true, plain, scale),
+                                    expand(displayGrey, plain, scale), scale, "packed, plain"));
+    worst = std::max(worst, compare(draw(program, levelTexture, false, plain, scale),
+                                    expand(levels, plain, scale), scale, "levels, plain"));
+    worst = std::max(worst, compare(draw(program, packedTexture, true, amber, scale),
+                                    expand(displayGrey, amber, scale), scale, "packed, palette + scanlines"));
+    worst = std::max(worst, compare(draw(program, levelTexture, false, amber, scale),
+                                    expand(levels, amber, scale), scale, "levels, palette + scanlines"));
+    if (glGetError() != GL_NO_ERROR) {
+        std::cerr << "GL error" << std::endl;
+        return 1;
+    }
+    return worst > 1 ? 1 : 0;
+}
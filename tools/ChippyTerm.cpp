@@ -0,0 +1,384 @@
+//
+//  ChippyTerm.cpp
+//  Chippy
+//
+//  Runs a ROM in the terminal, e.g. to watch it live over SSH.
+//
+//    chippy-term ROM [--braille] [--fps N] [--ipf N] [--seed S] [--hold N] [--fusion] [--publish NAME]
+//                    [--link PORT:HOST:PORT] [--vip]
+//
+//  The screen is drawn by TerminalRenderer (only changed cells, one write()
+//  per refresh; --fps sets the refresh rate, the game itself always runs at
+//  60 Hz). Input is read in raw mode with the app's keypad layout
+//  (1234/QWER/ASDF/ZXCV) and queued on the emulator the moment it arrives.
+//  Terminals report presses but not releases, so a release is queued --hold
+//  frames after the last press; auto-repeat keeps the key held. The status
+//  line shows the time from the latest key to the refresh that showed its
+//  effect. Tab toggles fast-forward, [ and ] change its speed. Ctrl-C or Esc quits.
+//  --publish NAME shares the live state for chippy-inspect (see StatePublisher).
+//  --link plays against a second chippy-term over UDP (see RollbackLink):
+//  listen on PORT, send to HOST:PORT; both sides need the same ROM and --seed.
+//  The game then runs at exactly 60 fps without fast-forward, and the status
+//  line shows rollbacks and bandwidth.
+//  --vip runs at COSMAC VIP speed (see CycleModel) instead of --ipf
+//  instructions per frame; linked peers must both use it or neither.
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "CycleModel.hpp"
+#include "Emulator.hpp"
+#include "FramePacer.hpp"
+#include "RollbackLink.hpp"
+#include "StatePublisher.hpp"
+#include "TerminalRenderer.hpp"
+
+namespace {
+
+volatile sig_atomic_t quitRequested = 0;
+volatile sig_atomic_t resized = 0;
+
+void onQuit(int) { quitRequested = 1; }
+void onResize(int) { resized = 1; }
+
+struct termios savedTermios;
+
+void restoreTerminal()
+{
+    static const char leave[] = "\x1b[0m\x1b[?25h\x1b[?1049l";
+    ssize_t n = write(STDOUT_FILENO, leave, sizeof(leave) - 1);
+    (void)n;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &savedTermios);
+}
+
+bool enterRawMode()
+{
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &savedTermios) != 0)
+        return false;
+    struct termios raw = savedTermios;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cflag |= CS8;
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) != 0)
+        return false;
+    // alternate screen, hide the cursor, clear.
+    static const char enter[] = "\x1b[?1049h\x1b[?25l\x1b[2J";
+    ssize_t n = write(STDOUT_FILENO, enter, sizeof(enter) - 1);
+    (void)n;
+    return true;
+}
+
+void writeAll(const std::string &s)
+{
+    const char *p = s.data();
+    size_t left = s.size();
+    while (left) {
+        ssize_t n = write(STDOUT_FILENO, p, left);
+        if (n <= 0)
+            return;
+        p += n;
+        left -= (size_t)n;
+    }
+}
+
+const ssize_t maxEscape = 16;
+const auto escapeTimeout = std::chrono::milliseconds(50);
+
+// bytes in the escape sequence at buf[0] (an Esc): CSI (Esc [ parameters
+// final) as arrows and most function keys send, SS3 (Esc O final) as some
+// terminals send for F1-F4 and arrows, or Esc and one byte (Alt+key).
+// 0 if the sequence is not complete yet: over SSH the rest often comes in
+// the next read. A lone Esc is the Esc key only once escapeTimeout passes.
+ssize_t escapeLength(const char *buf, ssize_t n)
+{
+    if (n < 2)
+        return 0;
+    if (buf[1] == 'O')
+        return n < 3 ? 0 : 3;
+    if (buf[1] != '[')
+        return 2;
+    ssize_t i = 2;
+    while (i < n && !(buf[i] >= 0x40 && buf[i] <= 0x7E))
+        ++i;
+    if (i == n)
+        return n < maxEscape ? 0 : n;
+    return i + 1;
+}
+
+// same layout as ChippyApp::keyDown().
+int keypadIndex(char c)
+{
+    switch (c) {
+        case '1': return 0x1; case '2': return 0x2; case '3': return 0x3; case '4': return 0xC;
+        case 'q': return 0x4; case 'w': return 0x5; case 'e': return 0x6; case 'r': return 0xD;
+        case 'a': return 0x7; case 's': return 0x8; case 'd': return 0x9; case 'f': return 0xE;
+        case 'z': return 0xA; case 'x': return 0x0; case 'c': return 0xB; case 'v': return 0xF;
+        default: return -1;
+    }
+}
+
+struct Options {
+    std::string rom;
+    TerminalRenderer::Mode mode = TerminalRenderer::Mode::HalfBlock;
+    int fps = 60;
+    int instructionsPerFrame = 10;
+    uint32_t seed = 0;
+    bool seeded = false;
+    int holdFrames = 8;
+    bool fusion = false;
+    bool vip = false;
+    std::string publish;
+    int linkPort = 0;
+    std::string peerHost;
+    int peerPort = 0;
+};
+
+void usage()
+{
+    std::cerr << "usage: chippy-term ROM [--braille] [--fps N] [--ipf N] [--seed S] [--hold N] [--fusion] [--publish NAME]\n"
+                 "                       [--link PORT:HOST:PORT] [--vip]\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (a == "--braille")
+            opt.mode = TerminalRenderer::Mode::Braille;
+        else if (a == "--fusion")
+            opt.fusion = true;
+        else if (a == "--vip")
+            opt.vip = true;
+        else if (a == "--fps" && hasValue)
+            opt.fps = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--ipf" && hasValue)
+            opt.instructionsPerFrame = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--hold" && hasValue)
+            opt.holdFrames = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--publish" && hasValue)
+            opt.publish = argv[++i];
+        else if (a == "--link" && hasValue) {
+            std::string v = argv[++i];
+            size_t first = v.find(':'), last = v.rfind(':');
+            if (first == std::string::npos || first == last) {
+                usage();
+                return 2;
+            }
+            opt.linkPort = std::atoi(v.c_str());
+            opt.peerHost = v.substr(first + 1, last - first - 1);
+            opt.peerPort = std::atoi(v.c_str() + last + 1);
+        }
+        else if (a == "--seed" && hasValue) {
+            opt.seed = (uint32_t)std::strtoul(argv[++i], nullptr, 0);
+            opt.seeded = true;
+        }
+        else if (a[0] != '-' && opt.rom.empty())
+            opt.rom = a;
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (opt.rom.empty()) {
+        usage();
+        return 2;
+    }
+
+    Emulator emu;
+    // linked peers must draw the same random numbers.
+    if (opt.seeded || opt.linkPort)
+        emu.seedRandom(opt.seed);
+    emu.instructionsPerFrame = opt.instructionsPerFrame;
+    emu.setFusion(opt.fusion);
+    if (opt.vip)
+        emu.cycleModel = &CycleModel::vip();
+    if (!emu.loadBinary(opt.rom)) {
+        std::cerr << "could not load " << opt.rom << std::endl;
+        return 1;
+    }
+    StatePublisher publisher;
+    if (!opt.publish.empty()) {
+        if (!publisher.open(opt.publish)) {
+            std::cerr << "could not create shared memory " << opt.publish << std::endl;
+            return 1;
+        }
+        emu.frameSink = &publisher;
+    }
+    // linked, a frame is one advance() with the keys held at the time, so the
+    // refresh rate is the game's.
+    std::unique_ptr<RollbackLink> link;
+    if (opt.linkPort) {
+        link.reset(new RollbackLink(emu, RollbackLink::Options()));
+        if (!link->open(opt.linkPort, opt.peerHost, opt.peerPort)) {
+            std::perror("chippy-term: --link");
+            return 1;
+        }
+        opt.fps = 60;
+    }
+    if (!enterRawMode()) {
+        std::cerr << "chippy-term needs a terminal on stdin" << std::endl;
+        return 1;
+    }
+    std::signal(SIGINT, onQuit);
+    std::signal(SIGTERM, onQuit);
+    std::signal(SIGHUP, onQuit);
+    std::signal(SIGWINCH, onResize);
+
+    TerminalRenderer renderer(opt.mode, 1, 1);
+    FramePacer pacer;
+    const double multiples[] = { 2, 4, 8, 16, 0 };
+    int multipleIndex = 1;
+    pacer.setMultiple(multiples[multipleIndex]);
+    const int statusRow = renderer.rows() + 1;
+    int held[16] = {};
+    std::string out;
+    out.reserve(16384);
+
+    typedef std::chrono::steady_clock Clock;
+    const auto frameTime = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / opt.fps));
+    auto deadline = Clock::now();
+    auto statusTime = deadline;
+    uint64_t frames = 0, framesAtStatus = 0, instructionsAtStatus = 0, bytesAtStatus = 0;
+    double latencyMs = 0;
+    std::string input;          // an escape sequence still being read
+    Clock::time_point escapeAt; // when its last byte came
+
+    while (!quitRequested) {
+        // wait for the next frame in poll() so key presses arrive as they happen.
+        deadline += frameTime;
+        for (;;) {
+            auto now = Clock::now();
+            // nothing followed the Esc: it was the key, or a sequence cut short.
+            if (!input.empty() && now - escapeAt >= escapeTimeout) {
+                if (input == "\x1b")
+                    quitRequested = 1;
+                input.clear();
+            }
+            if (now >= deadline)
+                break;
+            auto until = input.empty() ? deadline : std::min(deadline, escapeAt + escapeTimeout);
+            int timeout = (int)std::chrono::duration_cast<std::chrono::milliseconds>(until - now).count();
+            struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+            if (timeout == 0) {
+                std::this_thread::sleep_until(until);
+                continue;
+            }
+            if (poll(&pfd, 1, timeout) <= 0 || !(pfd.revents & POLLIN))
+                continue;
+            char buf[64];
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (n <= 0)
+                continue;
+            input.append(buf, (size_t)n);
+            size_t i = 0;
+            for (; i < input.size(); ++i) {
+                const char c = input[i];
+                // an arrow/function key is skipped whole so its '[' and letters
+                // are not taken as keys; an unfinished one waits for more bytes.
+                if (c == 0x1b) {
+                    ssize_t length = escapeLength(input.data() + i, (ssize_t)(input.size() - i));
+                    if (length == 0)
+                        break;
+                    i += (size_t)length - 1;
+                    continue;
+                }
+                if (c == 0x03)
+                    quitRequested = 1;
+                else if (c == '\t' && !link)
+                    pacer.setFastForward(!pacer.isFastForward());
+                else if (c == '[' || c == ']') {
+                    multipleIndex = std::max(0, std::min(4, multipleIndex + (c == ']' ? 1 : -1)));
+                    pacer.setMultiple(multiples[multipleIndex]);
+                }
+                int key = keypadIndex((char)std::tolower((unsigned char)c));
+                if (key < 0)
+                    continue;
+                if (held[key] == 0 && !link)
+                    emu.pushKeyEvent((uint8_t)key, true, Emulator::timestampNow());
+                held[key] = opt.holdFrames;
+            }
+            input.erase(0, i);
+            if (!input.empty())
+                escapeAt = Clock::now();
+        }
+        // running late (e.g. the terminal stalled): don't try to catch up.
+        if (Clock::now() - deadline > frameTime * 4)
+            deadline = Clock::now();
+
+        uint16_t heldMask = 0;
+        for (int k = 0; k < 16; ++k) {
+            if (held[k] > 0)
+                heldMask |= 1 << k;
+            if (held[k] > 0 && --held[k] == 0 && !link)
+                emu.pushKeyEvent((uint8_t)k, false);
+        }
+        if (link)
+            link->advance(heldMask);
+        else
+            pacer.advance(emu, 1.0 / opt.fps);
+        ++frames;
+
+        out.clear();
+        bool redraw = resized;
+        if (redraw) {
+            resized = 0;
+            out += "\x1b[2J";
+            renderer.invalidate();
+        }
+        if (emu.drawDisplay || !out.empty()) {
+            renderer.render(emu, out);
+            emu.drawDisplay = false;
+        }
+        if (uint64_t pressed = emu.takeShownInputTimestamp())
+            latencyMs = (Emulator::timestampNow() - pressed) / 1e6;
+        auto now = Clock::now();
+        if (now - statusTime >= std::chrono::seconds(1) || frames == 1 || redraw) {
+            double seconds = std::chrono::duration<double>(now - statusTime).count();
+            char status[160];
+            int len = std::snprintf(status, sizeof(status), "\x1b[%d;1H\x1b[2K%s%.1fx  %.0f fps  %.0f ips  input %.1f ms  pc %03X%s%s  Ctrl-C quits",
+                                    statusRow, pacer.isFastForward() ? ">> " : "", pacer.achievedMultiple(), seconds < 0.5 ? 0.0 : (frames - framesAtStatus) / seconds,
+                                    seconds < 0.5 ? 0.0 : (emu.statTotalInstructions - instructionsAtStatus) / seconds,
+                                    latencyMs, emu.getPC(), emu.waitForKey ? "  [waiting for key]" : "",
+                                    emu.halted ? "  [halted]" : "");
+            if (link) {
+                const RollbackLink::Stats &s = link->stats();
+                len = std::snprintf(status, sizeof(status), "\x1b[%d;1H\x1b[2K%s  frame %llu  rollback %d (max %d, %.2f ms)  stalls %llu  %.0f B/s%s  Ctrl-C quits",
+                                    statusRow, link->connected() ? "linked" : "waiting for peer", (unsigned long long)link->frame(),
+                                    s.lastRollbackDepth, s.maxRollbackDepth, s.lastResimulationMs, (unsigned long long)s.stalls,
+                                    seconds < 0.5 ? 0.0 : (s.bytesSent - bytesAtStatus) / seconds, s.desyncs ? "  DESYNC" : "");
+                bytesAtStatus = s.bytesSent;
+            }
+            out.append(status, std::min<int>(len, sizeof(status) - 1));
+            statusTime = now;
+            framesAtStatus = frames;
+            instructionsAtStatus = emu.statTotalInstructions;
+        }
+        if (!out.empty())
+            writeAll(out);
+    }
+
+    restoreTerminal();
+    return 0;
+}
@@ -0,0 +1,410 @@
+//
+//  RegressionSuite.cpp
+//  Chippy
+//
+//  Runs every ROM in a corpus headless with scripted input and a fixed seed,
+//  hashes the display at checkpoints and compares the result (and the
+//  instructions/sec throughput) against a stored golden file.
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "Emulator.hpp"
+#include "Phosphor.hpp"
+#include "VideoRecorder.hpp"
+
+namespace {
+
+struct Options {
+    std::vector<std::string> dirs;
+    std::string goldenFile = "tools/RegressionGolden.txt";
+    int frames = 3000;
+    int checkpoint = 60;
+    int repeats = 3;
+    uint32_t seed = 0xC8C8C8C8;
+    unsigned threads = 0;
+    double tolerance = 0.25;   // fraction of golden ips we may lose before reporting a slowdown.
+    bool checkThroughput = false;   // count slowdowns as failures; golden ips are from another host
+    double minSeconds = 0.05;  // each timed repeat runs the script until this much time has passed
+    bool update = false;
+    int fusion = -1;           // -1 leaves the emulator's default
+    std::string recordDir;
+    VideoRecorder::Format recordFormat = VideoRecorder::Format::Y4M;
+    float phosphor = -1;       // decay for phosphor-composited recordings; negative records raw frames
+};
+
+struct Golden {
+    double ips = 0;
+    std::vector<uint64_t> hashes;
+};
+
+struct Result {
+    std::string rom;
+    bool loaded = false;
+    std::vector<uint64_t> hashes;
+    double ips = 0;
+    bool deterministic = true;
+    bool halted = false;
+    uint16_t haltOpcode = 0;
+    uint16_t haltPc = 0;
+};
+
+void findRoms(const std::string &dir, std::vector<std::string> &out)
+{
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return;
+    while (dirent *e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name == "." || name == "..")
+            continue;
+        std::string path = dir + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            findRoms(path, out);
+        else if (name.size() > 4 && name.compare(name.size() - 4, 4, ".ch8") == 0)
+            out.push_back(path);
+    }
+    closedir(d);
+}
+
+// scripted input: every few frames switch to a new pseudo-random key mask (often none, sometimes one key).
+uint16_t scriptedKeys(uint32_t &state, int frame, uint16_t current)
+{
+    if (frame % 6 != 0)
+        return current;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    if (state & 1)
+        return 0;
+    return 1 << ((state >> 1) & 0xF);
+}
+
+// records the frames a Phosphor composites, rather than the raw display.
+struct PhosphorVideo : FrameSink {
+    Phosphor phosphor;
+    VideoRecorder::Stream *video;
+
+    PhosphorVideo(float decay, VideoRecorder::Stream *video) : phosphor(decay), video(video) { phosphor.next = this; }
+    void frameComplete(const Emulator&) override { video->pushLuma(phosphor.pixels()); }
+};
+
+// one complete scripted run; returns the checkpoint hashes, the executed
+// instruction count and the time spent in runFrame() (not loading).
+std::vector<uint64_t> runRom(const std::string &rom, const Options &opt, Result &res, uint64_t &instructions,
+                             double &seconds, VideoRecorder::Stream *video)
+{
+    std::vector<uint64_t> hashes;
+    Emulator emu;
+    emu.seedRandom(opt.seed);
+    if (opt.fusion >= 0)
+        emu.setFusion(opt.fusion != 0);
+    if (!emu.loadBinary(rom))
+        return hashes;
+    res.loaded = true;
+    emu.frameSink = video;
+    std::unique_ptr<PhosphorVideo> shaded;
+    if (video && opt.phosphor >= 0) {
+        shaded.reset(new PhosphorVideo(opt.phosphor, video));
+        emu.displaySink = emu.frameSink = &shaded->phosphor;
+    }
+
+    uint32_t inputState = opt.seed | 1;
+    uint16_t keys = 0;
+    instructions = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = 1; frame <= opt.frames; ++frame) {
+        keys = scriptedKeys(inputState, frame, keys);
+        emu.setKeyMask(keys);
+        emu.runFrame();
+        instructions += emu.statInstructionCount;
+        emu.statInstructionCount = 0;
+        if (frame % opt.checkpoint == 0)
+            hashes.push_back(emu.displayHash());
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    res.halted = emu.halted;
+    res.haltOpcode = emu.haltOpcode;
+    res.haltPc = emu.getPC();
+    return hashes;
+}
+
+std::string videoPath(const std::string &rom, const Options &opt)
+{
+    auto slash = rom.find_last_of('/');
+    std::string name = rom.substr(slash == std::string::npos ? 0 : slash + 1);
+    name = name.substr(0, name.size() - 4);
+    return opt.recordDir + "/" + name + (opt.recordFormat == VideoRecorder::Format::Y4M ? ".y4m" : ".c8v");
+}
+
+void runOne(const std::string &rom, const Options &opt, Result &res, VideoRecorder *recorder)
+{
+    res.rom = rom;
+    double best = 0;
+    for (int r = 0; r < opt.repeats; ++r) {
+        // only the first run is recorded; the timed best-of is normally taken from the others.
+        VideoRecorder::Stream *video = nullptr;
+        if (recorder && r == 0) {
+            video = recorder->open(videoPath(rom, opt), opt.recordFormat);
+            if (!video)
+                std::cerr << "could not record " << videoPath(rom, opt) << std::endl;
+        }
+        // a script is a few thousand frames, too short to time on its own:
+        // run it again until the repeat has taken minSeconds.
+        uint64_t instructions = 0;
+        double seconds = 0;
+        do {
+            uint64_t runInstructions = 0;
+            double runSeconds = 0;
+            auto hashes = runRom(rom, opt, res, runInstructions, runSeconds, video);
+            if (video) {
+                video->close();
+                video = nullptr;
+            }
+            if (!res.loaded)
+                return;
+            if (r == 0 && instructions == 0)
+                res.hashes = hashes;
+            else if (hashes != res.hashes)
+                res.deterministic = false;
+            instructions += runInstructions;
+            seconds += runSeconds;
+        } while (seconds < opt.minSeconds && !res.halted);
+        if (seconds > 0)
+            best = std::max(best, instructions / seconds);
+    }
+    res.ips = best;
+}
+
+std::map<std::string, Golden> readGolden(const std::string &file)
+{
+    std::map<std::string, Golden> golden;
+    std::ifstream in(file);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        std::string rom, ips, hashes;
+        if (!std::getline(fields, rom, '\t') || !std::getline(fields, ips, '\t') || !std::getline(fields, hashes))
+            continue;
+        Golden g;
+        g.ips = std::atof(ips.c_str());
+        std::istringstream hs(hashes);
+        std::string h;
+        while (hs >> h)
+            g.hashes.push_back(std::strtoull(h.c_str(), nullptr, 16));
+        golden[rom] = g;
+    }
+    return golden;
+}
+
+bool writeGolden(const std::string &file, const std::vector<Result> &results, const Options &opt)
+{
+    std::ofstream out(file);
+    if (!out)
+        return false;
+    out << "# chippy regression golden file: rom<TAB>instructions/sec<TAB>display hashes\n";
+    out << "# frames=" << opt.frames << " checkpoint=" << opt.checkpoint << " seed=0x" << std::hex << opt.seed << std::dec << "\n";
+    for (auto &r : results) {
+        if (!r.loaded)
+            continue;
+        out << r.rom << '\t' << (uint64_t)r.ips << '\t';
+        char buf[17];
+        for (size_t i = 0; i < r.hashes.size(); ++i) {
+            std::snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)r.hashes[i]);
+            out << (i ? " " : "") << buf;
+        }
+        out << '\n';
+    }
+    return true;
+}
+
+void usage()
+{
+    std::cerr << "usage: chippy-regress [options] [rom dirs...]   (default dir: programs)\n"
+                 "  --golden FILE      golden hash file (default tools/RegressionGolden.txt)\n"
+                 "  --update           rewrite the golden file from this run\n"
+                 "  --frames N         frames to run per rom (default 3000)\n"
+                 "  --checkpoint N     hash the display every N frames (default 60)\n"
+                 "  --repeats N        timed repeats per rom, best is kept (default 3)\n"
+                 "  --seed S           random seed for Cxkk and the input script\n"
+                 "  --threads N        worker threads (default: all cores)\n"
+                 "  --tolerance F      allowed throughput loss vs golden, 0..1 (default 0.25)\n"
+                 "  --check-throughput fail on a throughput loss too; otherwise it is only reported\n"
+                 "  --min-time S       seconds each timed repeat runs the script for (default 0.05)\n"
+                 "  --fusion on|off    force superinstruction fusion on or off\n"
+                 "  --record DIR       write a video of each rom's first run into DIR\n"
+                 "  --record-format F  y4m (default) or packed\n"
+                 "  --phosphor DECAY   record phosphor-composited frames (decay 0..1, e.g. 0.6)\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto next = [&]() -> const char * {
+            if (i + 1 >= argc) {
+                usage();
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+        if (a == "--golden")
+            opt.goldenFile = next();
+        else if (a == "--update")
+            opt.update = true;
+        else if (a == "--frames")
+            opt.frames = std::atoi(next());
+        else if (a == "--checkpoint")
+            opt.checkpoint = std::max(1, std::atoi(next()));
+        else if (a == "--repeats")
+            opt.repeats = std::max(1, std::atoi(next()));
+        else if (a == "--seed")
+            opt.seed = (uint32_t)std::strtoul(next(), nullptr, 0);
+        else if (a == "--threads")
+            opt.threads = (unsigned)std::atoi(next());
+        else if (a == "--tolerance")
+            opt.tolerance = std::atof(next());
+        else if (a == "--check-throughput")
+            opt.checkThroughput = true;
+        else if (a == "--min-time")
+            opt.minSeconds = std::atof(next());
+        else if (a == "--fusion")
+            opt.fusion = std::string(next()) == "on" ? 1 : 0;
+        else if (a == "--record")
+            opt.recordDir = next();
+        else if (a == "--record-format")
+            opt.recordFormat = std::string(next()) == "packed" ? VideoRecorder::Format::Packed : VideoRecorder::Format::Y4M;
+        else if (a == "--phosphor")
+            opt.phosphor = (float)std::atof(next());
+        else if (a == "-h" || a == "--help") {
+            usage();
+            return 0;
+        }
+        else
+            opt.dirs.push_back(a);
+    }
+    if (opt.dirs.empty())
+        opt.dirs.push_back("programs");
+
+    std::vector<std::string> roms;
+    for (auto &d : opt.dirs)
+        findRoms(d, roms);
+    std::sort(roms.begin(), roms.end());
+    if (roms.empty()) {
+        std::cerr << "no .ch8 files found" << std::endl;
+        return 2;
+    }
+
+    unsigned threads = opt.threads ? opt.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<unsigned>(threads, (unsigned)roms.size());
+
+    std::unique_ptr<VideoRecorder> recorder;
+    if (!opt.recordDir.empty())
+        recorder.reset(new VideoRecorder(8192, false)); // offline: keep every frame
+
+    std::vector<Result> results(roms.size());
+    std::atomic<size_t> nextRom(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            for (size_t i; (i = nextRom++) < roms.size();)
+                runOne(roms[i], opt, results[i], recorder.get());
+        });
+    }
+    for (auto &w : workers)
+        w.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (recorder) {
+        auto dropped = recorder->framesDropped();
+        recorder.reset(); // flushes the queue
+        if (dropped)
+            std::cerr << dropped << " video frames dropped (writer could not keep up)" << std::endl;
+    }
+
+    if (opt.update) {
+        if (!writeGolden(opt.goldenFile, results, opt)) {
+            std::cerr << "could not write " << opt.goldenFile << std::endl;
+            return 2;
+        }
+        std::cout << "wrote " << results.size() << " entries to " << opt.goldenFile << std::endl;
+        return 0;
+    }
+
+    auto golden = readGolden(opt.goldenFile);
+    int failures = 0, slowdowns = 0;
+    for (auto &r : results) {
+        std::string status = "ok";
+        std::ostringstream detail;
+        if (!r.loaded) {
+            status = "LOAD FAIL";
+            ++failures;
+        }
+        else if (!r.deterministic) {
+            status = "NONDETERMINISTIC";
+            ++failures;
+        }
+        else {
+            auto g = golden.find(r.rom);
+            if (g == golden.end()) {
+                status = "new";
+            }
+            else {
+                size_t n = std::min(g->second.hashes.size(), r.hashes.size());
+                size_t i = 0;
+                while (i < n && g->second.hashes[i] == r.hashes[i])
+                    ++i;
+                if (i < n || g->second.hashes.size() != r.hashes.size()) {
+                    status = "MISMATCH";
+                    detail << " first diff at frame " << (i + 1) * opt.checkpoint;
+                    ++failures;
+                }
+                else if (g->second.ips > 0 && r.ips < g->second.ips * (1.0 - opt.tolerance)) {
+                    // upper case only when it fails the run.
+                    status = opt.checkThroughput ? "SLOW" : "slow";
+                    ++slowdowns;
+                }
+                if (g->second.ips > 0)
+                    detail << " (golden " << (uint64_t)g->second.ips << " ips, "
+                           << (int)(100.0 * r.ips / g->second.ips) << "%)";
+            }
+        }
+        if (r.halted) {
+            char buf[48];
+            std::snprintf(buf, sizeof(buf), " halted: opcode %04X at %03X", r.haltOpcode, r.haltPc);
+            detail << buf;
+        }
+        std::printf("%-16s %12llu ips  %s%s\n", status.c_str(), (unsigned long long)r.ips, r.rom.c_str(), detail.str().c_str());
+    }
+    std::printf("%zu roms, %d correctness failures, %d throughput regressions%s, %.2fs on %u threads\n",
+                results.size(), failures, slowdowns, opt.checkThroughput ? "" : " (not checked)", elapsed.count(),
+                threads);
+    return (failures || (opt.checkThroughput && slowdowns)) ? 1 : 0;
+}
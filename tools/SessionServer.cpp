@@ -0,0 +1,542 @@
+//
+//  SessionServer.cpp
+//  Chippy
+//
+//  Hosts many Emulator sessions behind a Unix domain socket so external test
+//  and bot processes can drive them (see src/ServerProtocol.hpp).
+//
+//  One event loop thread per core; each accepted connection is pinned to a
+//  loop and owns its sessions, so sessions never need locking. Every loop
+//  reads everything that is available, answers all complete requests into
+//  one buffer and writes the replies back with a single write(). A client
+//  that does not read its replies stops being read from once outHighWater
+//  bytes of them are waiting.
+//
+//  `--bench ROM` runs a client that measures the step round trip instead.
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Emulator.hpp"
+#include "ServerProtocol.hpp"
+
+using namespace protocol;
+
+namespace {
+
+const size_t readChunk = 64 * 1024;
+const size_t readLimit = sizeof(Header) + maxPayload;  // unprocessed input: one whole request at most
+const size_t outHighWater = 1 << 20;        // unread replies
+
+struct Session {
+    Emulator emulator;
+    uint64_t frames = 0;
+    uint64_t instructions = 0;
+};
+
+struct Connection {
+    int fd;
+    std::vector<uint8_t> in;
+    size_t inPos = 0;
+    std::vector<uint8_t> out;
+    std::unordered_map<uint32_t, std::unique_ptr<Session>> sessions;
+    uint32_t nextSession = 1;
+};
+
+class EventLoop
+{
+public:
+    EventLoop()
+    {
+        if (pipe(wakePipe) != 0) {
+            perror("pipe");
+            std::exit(1);
+        }
+        fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+        thread = std::thread(&EventLoop::run, this);
+    }
+
+    void adopt(int fd)
+    {
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            pending.push_back(fd);
+        }
+        char c = 0;
+        (void)!write(wakePipe[1], &c, 1);
+    }
+
+    void join() { thread.join(); }
+
+private:
+    std::thread thread;
+    int wakePipe[2];
+    std::mutex pendingMutex;
+    std::vector<int> pending;
+    std::vector<std::unique_ptr<Connection>> connections;
+
+    void run();
+    bool readFrom(Connection&);
+    bool flush(Connection&);
+    void process(Connection&);
+    void handle(Connection&, const Header&, const uint8_t *payload);
+    void reply(Connection&, const Header&, uint8_t status, uint32_t session, const void *payload, size_t size,
+               const void *extra = nullptr, size_t extraSize = 0);
+};
+
+void EventLoop::run()
+{
+    std::vector<pollfd> fds;
+    for (;;) {
+        fds.clear();
+        fds.push_back({ wakePipe[0], POLLIN, 0 });
+        for (auto &c : connections)
+            fds.push_back({ c->fd, (short)((c->out.size() < outHighWater ? POLLIN : 0) |
+                                           (c->out.empty() ? 0 : POLLOUT)), 0 });
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return;
+        }
+
+        // fds[i + 1] belongs to connections[i]; walk backwards so closing can erase in place.
+        for (size_t i = connections.size(); i-- > 0;) {
+            auto &c = *connections[i];
+            short ev = fds[i + 1].revents;
+            bool alive = true;
+            if (ev & (POLLIN | POLLHUP | POLLERR))
+                alive = readFrom(c);
+            // requests held back by unread replies go as soon as those drain.
+            while (alive) {
+                size_t unprocessed = c.in.size() - c.inPos;
+                process(c);
+                if (!c.out.empty())
+                    alive = flush(c);
+                if (c.out.size() >= outHighWater || c.in.size() - c.inPos == unprocessed)
+                    break;
+            }
+            if (!alive) {
+                close(c.fd);
+                connections.erase(connections.begin() + i);
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char buf[64];
+            while (read(wakePipe[0], buf, sizeof(buf)) > 0)
+                ;
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            for (int fd : pending) {
+                std::unique_ptr<Connection> c(new Connection);
+                c->fd = fd;
+                connections.push_back(std::move(c));
+            }
+            pending.clear();
+        }
+    }
+}
+
+bool EventLoop::readFrom(Connection &c)
+{
+    // the rest stays in the socket until this has been answered.
+    while (c.in.size() - c.inPos < readLimit) {
+        size_t used = c.in.size();
+        c.in.resize(used + readChunk);
+        ssize_t n = read(c.fd, c.in.data() + used, readChunk);
+        c.in.resize(used + std::max<ssize_t>(n, 0));
+        if (n > 0)
+            continue;
+        if (n == 0)
+            return false;
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    return true;
+}
+
+bool EventLoop::flush(Connection &c)
+{
+    size_t done = 0;
+    while (done < c.out.size()) {
+        ssize_t n = write(c.fd, c.out.data() + done, c.out.size() - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return false;
+        }
+        done += n;
+    }
+    c.out.erase(c.out.begin(), c.out.begin() + done);
+    return true;
+}
+
+void EventLoop::process(Connection &c)
+{
+    while (c.out.size() < outHighWater && c.in.size() - c.inPos >= sizeof(Header)) {
+        Header h;
+        std::memcpy(&h, c.in.data() + c.inPos, sizeof(h));
+        if (h.length > maxPayload) {
+            // cannot resynchronise the stream; drop everything buffered.
+            reply(c, h, StatusBadRequest, h.session, nullptr, 0);
+            c.in.clear();
+            c.inPos = 0;
+            return;
+        }
+        if (c.in.size() - c.inPos < sizeof(Header) + h.length)
+            break;
+        handle(c, h, c.in.data() + c.inPos + sizeof(Header));
+        c.inPos += sizeof(Header) + h.length;
+    }
+    if (c.inPos == c.in.size()) {
+        c.in.clear();
+        c.inPos = 0;
+    }
+    else if (c.inPos > readChunk) {
+        c.in.erase(c.in.begin(), c.in.begin() + c.inPos);
+        c.inPos = 0;
+    }
+}
+
+void EventLoop::reply(Connection &c, const Header &req, uint8_t status, uint32_t session, const void *payload,
+                      size_t size, const void *extra, size_t extraSize)
+{
+    Header h = {};
+    h.length = (uint32_t)(size + extraSize);
+    h.op = req.op;
+    h.status = status;
+    h.session = session;
+    h.tag = req.tag;
+    auto *p = reinterpret_cast<const uint8_t*>(&h);
+    c.out.insert(c.out.end(), p, p + sizeof(h));
+    if (size) {
+        p = static_cast<const uint8_t*>(payload);
+        c.out.insert(c.out.end(), p, p + size);
+    }
+    if (extraSize) {
+        p = static_cast<const uint8_t*>(extra);
+        c.out.insert(c.out.end(), p, p + extraSize);
+    }
+}
+
+void EventLoop::handle(Connection &c, const Header &h, const uint8_t *payload)
+{
+    if (h.op == OpCreate) {
+        if (h.length < sizeof(CreateRequest))
+            return reply(c, h, StatusBadRequest, 0, nullptr, 0);
+        CreateRequest req;
+        std::memcpy(&req, payload, sizeof(req));
+        if (req.instructionsPerFrame > maxInstructionsPerFrame)
+            return reply(c, h, StatusBadRequest, 0, nullptr, 0);
+        std::unique_ptr<Session> s(new Session);
+        s->emulator.seedRandom(req.seed);
+        if (req.instructionsPerFrame)
+            s->emulator.instructionsPerFrame = (int)req.instructionsPerFrame;
+        if (!s->emulator.loadBinary(payload + sizeof(req), h.length - sizeof(req)))
+            return reply(c, h, StatusLoadFailed, 0, nullptr, 0);
+        uint32_t id = c.nextSession++;
+        c.sessions[id] = std::move(s);
+        return reply(c, h, StatusOk, id, nullptr, 0);
+    }
+
+    auto it = c.sessions.find(h.session);
+    if (it == c.sessions.end())
+        return reply(c, h, StatusBadSession, h.session, nullptr, 0);
+    Session &s = *it->second;
+    Emulator &emu = s.emulator;
+
+    switch (h.op) {
+        case OpLoad:
+            emu.reset();
+            if (!emu.loadBinary(payload, h.length))
+                return reply(c, h, StatusLoadFailed, h.session, nullptr, 0);
+            s.frames = s.instructions = 0;
+            return reply(c, h, StatusOk, h.session, nullptr, 0);
+
+        case OpStep: {
+            if (h.length < sizeof(StepRequest))
+                return reply(c, h, StatusBadRequest, h.session, nullptr, 0);
+            StepRequest req;
+            std::memcpy(&req, payload, sizeof(req));
+            if (req.frames > maxStepFrames ||
+                (uint64_t)req.frames * (uint64_t)emu.instructionsPerFrame > maxStepInstructions)
+                return reply(c, h, StatusBadRequest, h.session, nullptr, 0);
+            emu.setKeyMask(req.keyMask);
+            emu.statInstructionCount = 0;
+            for (uint32_t f = 0; f < req.frames; ++f)
+                emu.runFrame();
+            StepReply r = {};
+            r.instructions = (uint64_t)emu.statInstructionCount;
+            r.pc = emu.getPC();
+            r.halted = emu.halted;
+            r.waitForKey = emu.waitForKey;
+            r.sound = emu.makeSound();
+            s.frames += req.frames;
+            s.instructions += r.instructions;
+            if (h.flags & FlagFetchDisplay) {
+                uint8_t packed[displayBytes];
+                emu.packDisplay(packed);
+                return reply(c, h, StatusOk, h.session, &r, sizeof(r), packed, sizeof(packed));
+            }
+            return reply(c, h, StatusOk, h.session, &r, sizeof(r));
+        }
+
+        case OpFetchDisplay: {
+            uint8_t packed[displayBytes];
+            emu.packDisplay(packed);
+            return reply(c, h, StatusOk, h.session, packed, sizeof(packed));
+        }
+
+        case OpSaveState: {
+            std::unique_ptr<Emulator::State> state(new Emulator::State);
+            emu.saveState(*state);
+            return reply(c, h, StatusOk, h.session, state.get(), sizeof(Emulator::State));
+        }
+
+        case OpRestoreState: {
+            if (h.length != sizeof(Emulator::State))
+                return reply(c, h, StatusBadRequest, h.session, nullptr, 0);
+            std::unique_ptr<Emulator::State> state(new Emulator::State);
+            std::memcpy(static_cast<void*>(state.get()), payload, sizeof(Emulator::State));
+            if (!Emulator::isValidState(*state))
+                return reply(c, h, StatusBadRequest, h.session, nullptr, 0);
+            emu.loadState(*state);
+            return reply(c, h, StatusOk, h.session, nullptr, 0);
+        }
+
+        case OpStats: {
+            StatsReply r = {};
+            r.frames = s.frames;
+            r.instructions = s.instructions;
+            r.pc = emu.getPC();
+            r.haltOpcode = emu.haltOpcode;
+            r.halted = emu.halted;
+            r.waitForKey = emu.waitForKey;
+            r.sound = emu.makeSound();
+            return reply(c, h, StatusOk, h.session, &r, sizeof(r));
+        }
+
+        case OpDestroy:
+            c.sessions.erase(it);
+            return reply(c, h, StatusOk, h.session, nullptr, 0);
+
+        case OpFork: {
+            std::unique_ptr<Session> fork(new Session);
+            fork->emulator.instructionsPerFrame = emu.instructionsPerFrame;
+            fork->emulator.cycleModel = emu.cycleModel;
+            fork->emulator.cloneFrom(emu);
+            fork->frames = s.frames;
+            fork->instructions = s.instructions;
+            uint32_t id = c.nextSession++;
+            c.sessions[id] = std::move(fork);
+            return reply(c, h, StatusOk, id, nullptr, 0);
+        }
+
+        default:
+            return reply(c, h, StatusBadRequest, h.session, nullptr, 0);
+    }
+}
+
+int listenOn(const std::string &path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (fd < 0 || path.size() >= sizeof(addr.sun_path))
+        return -1;
+    std::strcpy(addr.sun_path, path.c_str());
+    unlink(path.c_str());
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int serve(const std::string &path, unsigned loops)
+{
+    int listenFd = listenOn(path);
+    if (listenFd < 0) {
+        perror(path.c_str());
+        return 1;
+    }
+    std::vector<std::unique_ptr<EventLoop>> workers;
+    for (unsigned i = 0; i < loops; ++i)
+        workers.emplace_back(new EventLoop);
+    std::cout << "chippy server on " << path << " with " << loops << " event loops" << std::endl;
+
+    for (size_t next = 0;; ++next) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("accept");
+            break;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        workers[next % workers.size()]->adopt(fd);
+    }
+    return 1;
+}
+
+// --- benchmark client -------------------------------------------------------
+
+bool sendAll(int fd, const void *data, size_t size)
+{
+    auto *p = static_cast<const uint8_t*>(data);
+    while (size) {
+        ssize_t n = write(fd, p, size);
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool recvAll(int fd, void *data, size_t size)
+{
+    auto *p = static_cast<uint8_t*>(data);
+    while (size) {
+        ssize_t n = read(fd, p, size);
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool recvReply(int fd, Header &h, std::vector<uint8_t> &payload)
+{
+    if (!recvAll(fd, &h, sizeof(h)))
+        return false;
+    payload.resize(h.length);
+    return recvAll(fd, payload.data(), h.length);
+}
+
+int bench(const std::string &path, const std::string &rom, int steps, int pipeline)
+{
+    std::ifstream file(rom, std::ios::binary);
+    std::vector<uint8_t> romData((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (romData.empty()) {
+        std::cerr << "could not read " << rom << std::endl;
+        return 1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror(path.c_str());
+        return 1;
+    }
+
+    Header h = {};
+    CreateRequest create = { 1234, 0 };
+    h.op = OpCreate;
+    h.length = (uint32_t)(sizeof(create) + romData.size());
+    std::vector<uint8_t> msg(sizeof(h) + h.length);
+    std::memcpy(msg.data(), &h, sizeof(h));
+    std::memcpy(msg.data() + sizeof(h), &create, sizeof(create));
+    std::memcpy(msg.data() + sizeof(h) + sizeof(create), romData.data(), romData.size());
+    std::vector<uint8_t> payload;
+    if (!sendAll(fd, msg.data(), msg.size()) || !recvReply(fd, h, payload) || h.status != StatusOk) {
+        std::cerr << "create failed" << std::endl;
+        return 1;
+    }
+    uint32_t session = h.session;
+
+    struct { Header h; StepRequest s; } step = {};
+    step.h.op = OpStep;
+    step.h.flags = FlagFetchDisplay;
+    step.h.length = sizeof(StepRequest);
+    step.h.session = session;
+    step.s.frames = 1;
+    pipeline = std::max(1, pipeline);
+    std::vector<decltype(step)> batch(pipeline, step);
+
+    auto start = std::chrono::steady_clock::now();
+    int done = 0;
+    while (done < steps) {
+        int n = std::min(pipeline, steps - done);
+        for (int i = 0; i < n; ++i)
+            batch[i].h.tag = done + i;
+        if (!sendAll(fd, batch.data(), n * sizeof(step)))
+            return 1;
+        for (int i = 0; i < n; ++i)
+            if (!recvReply(fd, h, payload) || h.status != StatusOk)
+                return 1;
+        done += n;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::printf("%d steps (pipeline %d): %.2f us per step, %.0f steps/s\n", steps, pipeline,
+                elapsed.count() * 1e6 / steps, steps / elapsed.count());
+    close(fd);
+    return 0;
+}
+
+void usage()
+{
+    std::cerr << "usage: chippy-server [--socket PATH] [--loops N]\n"
+                 "       chippy-server [--socket PATH] --bench ROM [--steps N] [--pipeline N]\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::string path = defaultSocketPath, benchRom;
+    unsigned loops = std::max(1u, std::thread::hardware_concurrency());
+    int steps = 100000, pipeline = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (a == "--socket" && hasValue)
+            path = argv[++i];
+        else if (a == "--loops" && hasValue)
+            loops = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--bench" && hasValue)
+            benchRom = argv[++i];
+        else if (a == "--steps" && hasValue)
+            steps = std::atoi(argv[++i]);
+        else if (a == "--pipeline" && hasValue)
+            pipeline = std::atoi(argv[++i]);
+        else {
+            usage();
+            return 2;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if (!benchRom.empty())
+        return bench(path, benchRom, steps, pipeline);
+    return serve(path, loops);
+}
@@ -0,0 +1,151 @@
+//
+//  TraceDump.cpp
+//  Chippy
+//
+//  Offline side of the binary execution trace (src/Trace.hpp).
+//
+//    chippy-trace dump FILE [--from N] [--count N]
+//        decode a .c8trace file into one disassembled line per instruction.
+//    chippy-trace record ROM FILE [--frames N] [--seed S] [--window FROM:COUNT]
+//        run a ROM headless with tracing on and dump the ring to FILE.
+//
+//  Copyright © 2016 bonsu. All rights reserved.
+//
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Disassembler.hpp"
+#include "Emulator.hpp"
+#include "Trace.hpp"
+
+namespace {
+
+int dump(const std::string &path, uint64_t from, uint64_t count)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        perror(path.c_str());
+        return 1;
+    }
+    char magic[8];
+    uint32_t recordSize = 0;
+    uint64_t records = 0;
+    if (fread(magic, sizeof(magic), 1, fp) != 1 || std::memcmp(magic, TraceBuffer::fileMagic, sizeof(magic)) != 0
+        || fread(&recordSize, sizeof(recordSize), 1, fp) != 1 || recordSize != sizeof(TraceRecord)
+        || fread(&records, sizeof(records), 1, fp) != 1) {
+        std::cerr << path << ": not a chippy trace" << std::endl;
+        fclose(fp);
+        return 1;
+    }
+
+    // cycles are stored as their low 32 bits; rebuild the full count as we go.
+    uint64_t cycle = 0;
+    uint32_t last = 0;
+    bool first = true;
+    TraceRecord r;
+    uint64_t printed = 0;
+    std::printf("%-12s %-5s %-6s %-18s %-8s %-7s %s\n", "cycle", "pc", "op", "instruction", "Vx", "I", "VF");
+    for (uint64_t i = 0; i < records && fread(&r, sizeof(r), 1, fp) == 1; ++i) {
+        if (first)
+            cycle = r.cycle;
+        else
+            cycle += (uint32_t)(r.cycle - last);
+        first = false;
+        last = r.cycle;
+        if (cycle < from)
+            continue;
+        if (printed++ >= count)
+            break;
+
+        char vx[16] = "";
+        if (opcodeWritesVx(r.opcode))
+            std::snprintf(vx, sizeof(vx), "V%X=%02X", r.reg, r.value);
+        std::printf("%-12llu %03X   %04X   %-18s %-8s I=%03X   %02X%s\n", (unsigned long long)cycle, r.pc, r.opcode,
+                    disassemble(r.opcode).c_str(), vx, r.I, r.vf, (r.flags & traceFlagHalted) ? "  HALTED" : "");
+    }
+    fclose(fp);
+    return 0;
+}
+
+int record(const std::string &rom, const std::string &path, int frames, uint32_t seed, uint64_t from, uint64_t count)
+{
+    Emulator emu;
+    emu.seedRandom(seed);
+    if (!emu.loadBinary(rom)) {
+        std::cerr << "could not load " << rom << std::endl;
+        return 1;
+    }
+    TraceBuffer trace;
+    trace.setWindow(from, count);
+    emu.tracer = &trace;
+    for (int f = 0; f < frames && !emu.halted; ++f)
+        emu.runFrame();
+    if (!trace.dump(path)) {
+        perror(path.c_str());
+        return 1;
+    }
+    std::cout << trace.recorded() << " instructions traced (ring keeps the last " << trace.capacity() << ")" << std::endl;
+    return 0;
+}
+
+void usage()
+{
+    std::cerr << "usage: chippy-trace dump FILE [--from N] [--count N]\n"
+                 "       chippy-trace record ROM FILE [--frames N] [--seed S] [--window FROM:COUNT]\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        usage();
+        return 2;
+    }
+    std::string mode = argv[1];
+    uint64_t from = 0, count = UINT64_MAX;
+    int frames = 600;
+    uint32_t seed = 1;
+    int positional = mode == "record" ? 2 : 1;
+    if (argc < 2 + positional) {
+        usage();
+        return 2;
+    }
+    for (int i = 2 + positional; i < argc; ++i) {
+        std::string a = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        const char *v = argv[++i];
+        if (a == "--from")
+            from = std::strtoull(v, nullptr, 0);
+        else if (a == "--count")
+            count = std::strtoull(v, nullptr, 0);
+        else if (a == "--frames")
+            frames = std::atoi(v);
+        else if (a == "--seed")
+            seed = (uint32_t)std::strtoul(v, nullptr, 0);
+        else if (a == "--window") {
+            char *end;
+            from = std::strtoull(v, &end, 0);
+            count = *end == ':' ? std::strtoull(end + 1, nullptr, 0) : UINT64_MAX;
+        }
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (mode == "dump")
+        return dump(argv[2], from, count);
+    if (mode == "record")
+        return record(argv[2], argv[3], frames, seed, from, count);
+    usage();
+    return 2;
+}